@@ -29,128 +29,328 @@
  */
 
 #include "address.hpp"
-#include <cctype>
 #include <cstring>
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 using namespace batv;
 
-bool Batv_address::parse (const Email_address& address, char sub_address_delimiter)
-{
-	const char*		p = address.local_part.c_str();
+namespace {
+	// Can c appear in a tag-type or tag-val?  (Unlike std::isalnum, this
+	// doesn't depend on the locale.)
+	inline bool	is_tag_char (char c)
+	{
+		const unsigned char	uc = static_cast<unsigned char>(c);
+		return static_cast<unsigned char>((uc | 0x20) - 'a') < 26 || static_cast<unsigned char>(uc - '0') < 10 || uc == '-';
+	}
 
-	if (sub_address_delimiter) {
-		// non-standard format, using sub-addressing
+	inline unsigned int	lowest_bit (uint32_t mask)	// mask must be non-zero
+	{
+#if defined(__GNUC__)
+		return __builtin_ctz(mask);
+#else
+		unsigned int	i = 0;
+		while (!(mask & 1)) { mask >>= 1; ++i; }
+		return i;
+#endif
+	}
 
-		// eat the loc-core (up to last delimiter character)
-		const char*	loc_core_start = p;
-		p = std::strrchr(p, sub_address_delimiter);
-		if (!p) {
-			return false;
+	inline unsigned int	highest_bit (uint32_t mask)	// mask must be non-zero
+	{
+#if defined(__GNUC__)
+		return 31 - __builtin_clz(mask);
+#else
+		unsigned int	i = 31;
+		while (!(mask & 0x80000000)) { mask <<= 1; --i; }
+		return i;
+#endif
+	}
+
+	// Where the separators are in a local part, found in one pass.  A separator
+	// is any character that can't appear in a tag-type or tag-val, such as '='
+	// or '+'.  Positions are offsets into the local part, or len if none.
+	struct Local_part_scan {
+		size_t		len;
+		size_t		first_sep;		// standard format: tag-type=tag-val=loc-core
+		size_t		second_sep;
+		size_t		last_delim;		// sub-address format: loc-core+tag-type=tag-val
+		size_t		first_sep_after_delim;
+		size_t		num_seps_after_delim;	// not exact past 1
+
+		explicit Local_part_scan (size_t arg_len)
+		{
+			len = arg_len;
+			first_sep = second_sep = len;
+			last_delim = first_sep_after_delim = len;
+			num_seps_after_delim = 0;
 		}
-		orig_mailfrom.local_part.assign(loc_core_start, p);
-		++p;
-		
-		// eat the tag-type (up to '=')
-		const char*	tag_type_start = p;
-		while (std::isdigit(*p) || std::isalpha(*p) || *p == '-') {
-			++p;
+
+		// Account for a chunk of up to 32 characters starting at offset, given
+		// bit masks of which of them are separators and delimiters
+		void		add_chunk (size_t offset, uint32_t sep_mask, uint32_t delim_mask)
+		{
+			uint32_t	seps_after_delim = sep_mask;
+			if (delim_mask) {
+				const unsigned int	last = highest_bit(delim_mask);
+				last_delim = offset + last;
+				first_sep_after_delim = len;
+				num_seps_after_delim = 0;
+				seps_after_delim &= ~(0xFFFFFFFFu >> (31 - last));
+			}
+			if (seps_after_delim) {
+				if (num_seps_after_delim == 0) {
+					first_sep_after_delim = offset + lowest_bit(seps_after_delim);
+				}
+				num_seps_after_delim += (seps_after_delim & (seps_after_delim - 1)) ? 2 : 1;
+			}
+			while (sep_mask && second_sep == len) {
+				(first_sep == len ? first_sep : second_sep) = offset + lowest_bit(sep_mask);
+				sep_mask &= sep_mask - 1;
+			}
 		}
-		if (*p != '=') {
-			return false;
+	};
+
+	// Classify up to 32 characters
+	inline void	classify_chunk (const char* p, size_t n, char delim, uint32_t* sep_mask, uint32_t* delim_mask)
+	{
+		*sep_mask = *delim_mask = 0;
+		for (size_t i = 0; i < n; ++i) {
+			*sep_mask |= static_cast<uint32_t>(!is_tag_char(p[i])) << i;
+			*delim_mask |= static_cast<uint32_t>(delim && p[i] == delim) << i;
 		}
-		tag_type.assign(tag_type_start, p);
-		++p;
+	}
+
+#if defined(__SSE2__)
+	// Classify exactly 16 characters
+	inline void	classify_chunk16 (const char* p, __m128i delim, bool have_delim, uint32_t* sep_mask, uint32_t* delim_mask)
+	{
+		// Bytes >= 0x80 are negative, so they fail the signed range checks
+		const __m128i	x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+		const __m128i	lower = _mm_or_si128(x, _mm_set1_epi8(0x20));
+		const __m128i	alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+		const __m128i	digit = _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(x, _mm_set1_epi8('9' + 1)));
+		const __m128i	dash = _mm_cmpeq_epi8(x, _mm_set1_epi8('-'));
 
-		// eat the tag-val (rest of local part)
-		const char*	tag_val_start = p;
-		while (std::isdigit(*p) || std::isalpha(*p) || *p == '-') {
-			++p;
+		*sep_mask = ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), dash)) & 0xFFFF;
+		*delim_mask = have_delim ? _mm_movemask_epi8(_mm_cmpeq_epi8(x, delim)) : 0;
+	}
+#endif
+
+	// DELIM is the sub-address delimiter if known at compile time,
+	// 0 if there isn't one, or -1 to use runtime_delim.
+	template<int DELIM> Local_part_scan scan_local_part (String_view local_part, char runtime_delim)
+	{
+		const char		delim = DELIM == -1 ? runtime_delim : static_cast<char>(DELIM);
+		const char*		p = local_part.data;
+		const size_t		len = local_part.size;
+		Local_part_scan		scan(len);
+		size_t			i = 0;
+		uint32_t		sep_mask;
+		uint32_t		delim_mask;
+
+#if defined(__SSE2__)
+		const __m128i		delim_vec = _mm_set1_epi8(delim);
+		for (; len - i >= 32; i += 32) {
+			uint32_t	sep_mask_hi;
+			uint32_t	delim_mask_hi;
+			classify_chunk16(p + i, delim_vec, delim != 0, &sep_mask, &delim_mask);
+			classify_chunk16(p + i + 16, delim_vec, delim != 0, &sep_mask_hi, &delim_mask_hi);
+			scan.add_chunk(i, sep_mask | (sep_mask_hi << 16), delim_mask | (delim_mask_hi << 16));
 		}
-		if (*p != '\0') {
-			return false;
+		if (len - i >= 16) {
+			classify_chunk16(p + i, delim_vec, delim != 0, &sep_mask, &delim_mask);
+			scan.add_chunk(i, sep_mask, delim_mask);
+			i += 16;
 		}
-		tag_val.assign(tag_val_start, p);
-	} else {
-		// standard BATV format
+		if (i < len && len >= 16) {
+			// Re-read the last 16 characters, discarding the ones already seen
+			const size_t	overlap = i - (len - 16);
+			classify_chunk16(p + len - 16, delim_vec, delim != 0, &sep_mask, &delim_mask);
+			scan.add_chunk(i, sep_mask >> overlap, delim_mask >> overlap);
+			i = len;
+		} else if (i < len) {
+			// Copy the string to a buffer so we don't read past the end
+			char		tail[16];
+			std::memcpy(tail, p, len);
+			classify_chunk16(tail, delim_vec, delim != 0, &sep_mask, &delim_mask);
+			const uint32_t	valid_mask = (1u << len) - 1;
+			scan.add_chunk(0, sep_mask & valid_mask, delim_mask & valid_mask);
+			i = len;
+		}
+#endif
+		for (; i < len; i += 32) {
+			const size_t	n = len - i < 32 ? len - i : 32;
+			classify_chunk(p + i, n, delim, &sep_mask, &delim_mask);
+			scan.add_chunk(i, sep_mask, delim_mask);
+		}
+		return scan;
+	}
 
-		// eat the tag-type
-		const char*	tag_type_start = p;
-		while (std::isdigit(*p) || std::isalpha(*p) || *p == '-') {
-			++p;
+	Local_part_scan	scan_local_part (String_view local_part, char sub_address_delimiter)
+	{
+		// Specialize the common delimiters so their comparisons are against constants
+		switch (sub_address_delimiter) {
+		case 0:		return scan_local_part<0>(local_part, 0);
+		case '+':	return scan_local_part<'+'>(local_part, 0);
+		case '-':	return scan_local_part<'-'>(local_part, 0);
+		default:	return scan_local_part<-1>(local_part, sub_address_delimiter);
 		}
-		if (*p != '=') {
+	}
+
+	// loc-core DELIM tag-type = tag-val
+	bool		assign_sub_address (Batv_address_view& out, const Email_address_view& address, const Local_part_scan& scan)
+	{
+		const char*	p = address.local_part.data;
+
+		if (scan.last_delim == scan.len || scan.num_seps_after_delim != 1 || p[scan.first_sep_after_delim] != '=') {
 			return false;
 		}
-		tag_type.assign(tag_type_start, p);
-		++p;
+		out.orig_mailfrom.local_part = String_view(p, scan.last_delim);
+		out.tag_type = String_view(p + scan.last_delim + 1, p + scan.first_sep_after_delim);
+		out.tag_val = String_view(p + scan.first_sep_after_delim + 1, p + scan.len);
+		out.orig_mailfrom.domain = address.domain;
+		return true;
+	}
 
-		// eat the tag-val
-		const char*	tag_val_start = p;
-		while (std::isdigit(*p) || std::isalpha(*p) || *p == '-') {
-			++p;
-		}
-		if (*p != '=') {
+	// tag-type = tag-val = loc-core
+	bool		assign_standard (Batv_address_view& out, const Email_address_view& address, const Local_part_scan& scan)
+	{
+		const char*	p = address.local_part.data;
+
+		if (scan.second_sep == scan.len || p[scan.first_sep] != '=' || p[scan.second_sep] != '=') {
 			return false;
 		}
-		tag_val.assign(tag_val_start, p);
-		++p;
+		out.tag_type = String_view(p, scan.first_sep);
+		out.tag_val = String_view(p + scan.first_sep + 1, p + scan.second_sep);
+		out.orig_mailfrom.local_part = String_view(p + scan.second_sep + 1, p + scan.len);
+		out.orig_mailfrom.domain = address.domain;
+		return true;
+	}
+}
+
+bool Batv_address_view::parse (const Email_address_view& address, char sub_address_delimiter)
+{
+	const Local_part_scan	scan(scan_local_part(address.local_part, sub_address_delimiter));
+
+	if (sub_address_delimiter) {
+		// non-standard format, using sub-addressing
+		return assign_sub_address(*this, address, scan);
+	} else {
+		// standard BATV format
+		return assign_standard(*this, address, scan);
+	}
+}
 
-		// eat the loc-core (rest of local part)
-		orig_mailfrom.local_part = p;
+Batv_address_view::Format Batv_address_view::parse_any (const Email_address_view& address, char sub_address_delimiter)
+{
+	const Local_part_scan	scan(scan_local_part(address.local_part, sub_address_delimiter));
+
+	if (sub_address_delimiter && assign_sub_address(*this, address, scan)) {
+		return FORMAT_SUB_ADDRESS;
+	}
+	if (assign_standard(*this, address, scan)) {
+		return FORMAT_STANDARD;
 	}
+	return FORMAT_NONE;
+}
 
-	orig_mailfrom.domain = address.domain;
+bool Batv_address::parse (const Email_address& address, char sub_address_delimiter)
+{
+	Batv_address_view	view;
+	if (!view.parse(address, sub_address_delimiter)) {
+		return false;
+	}
+	*this = Batv_address(view);
 	return true;
 }
 
-std::string	Batv_address::make_string (char sub_address_delimiter) const
+std::string	Batv_address_view::make_string (char sub_address_delimiter) const
 {
 	std::string		address_str;
+	make_string(&address_str, sub_address_delimiter);
+	return address_str;
+}
+
+void	Batv_address_view::make_string (std::string* address_str, char sub_address_delimiter) const
+{
+	address_str->reserve(tag_type.size + tag_val.size + orig_mailfrom.local_part.size + orig_mailfrom.domain.size + 3);
 
 	if (sub_address_delimiter) {
 		// non-standard format, using sub-addressing
-		address_str.assign(orig_mailfrom.local_part);
-		address_str.push_back(sub_address_delimiter);
-		address_str.append(tag_type);
-		address_str.push_back('=');
-		address_str.append(tag_val);
-		address_str.push_back('@');
-		address_str.append(orig_mailfrom.domain);
+		address_str->assign(orig_mailfrom.local_part.data, orig_mailfrom.local_part.size);
+		address_str->push_back(sub_address_delimiter);
+		address_str->append(tag_type.data, tag_type.size);
+		address_str->push_back('=');
+		address_str->append(tag_val.data, tag_val.size);
+		address_str->push_back('@');
+		address_str->append(orig_mailfrom.domain.data, orig_mailfrom.domain.size);
 	} else {
 		// standard BATV format
-		address_str.assign(tag_type);
-		address_str.push_back('=');
-		address_str.append(tag_val);
-		address_str.push_back('=');
-		address_str.append(orig_mailfrom.local_part);
-		address_str.push_back('@');
-		address_str.append(orig_mailfrom.domain);
-	}
-	
-	return address_str;
+		address_str->assign(tag_type.data, tag_type.size);
+		address_str->push_back('=');
+		address_str->append(tag_val.data, tag_val.size);
+		address_str->push_back('=');
+		address_str->append(orig_mailfrom.local_part.data, orig_mailfrom.local_part.size);
+		address_str->push_back('@');
+		address_str->append(orig_mailfrom.domain.data, orig_mailfrom.domain.size);
+	}
 }
 
+std::string	Batv_address::make_string (char sub_address_delimiter) const
+{
+	return Batv_address_view(*this).make_string(sub_address_delimiter);
+}
 
-std::string batv::canon_address (const char* addr)
+String_view	batv::canon_address_view (String_view addr)
 {
 	// Strip pairs of leading and trailing angle brackets from the address
-	const char*	start = addr;
-	const char*	end = addr + std::strlen(addr);
-	while (*start == '<' && *(end - 1) == '>') {
+	const char*	start = addr.begin();
+	const char*	end = addr.end();
+	while (end - start >= 2 && *start == '<' && *(end - 1) == '>') {
 		++start;
 		--end;
 	}
-	return std::string(start, end);
+	return String_view(start, end);
 }
 
-void	Email_address::parse (const char* str)
+std::string batv::canon_address (const char* addr)
+{
+	return canon_address_view(String_view(addr)).str();
+}
+
+void	Email_address_view::parse (String_view str)
 {
-	if (const char* at_sign_p = std::strchr(str, '@')) {
-		local_part.assign(str, at_sign_p);
-		domain.assign(at_sign_p + 1);
+	if (const char* at_sign_p = static_cast<const char*>(std::memchr(str.data, '@', str.size))) {
+		local_part = String_view(str.begin(), at_sign_p);
+		domain = String_view(at_sign_p + 1, str.end());
 	} else {
 		local_part = str;
-		domain.clear();
+		domain = String_view();
+	}
+}
+
+void	Email_address::parse (const char* str)
+{
+	Email_address_view	view;
+	view.parse(String_view(str));
+	*this = Email_address(view);
+}
+
+std::string	Email_address_view::make_string () const
+{
+	std::string		address_str;
+	make_string(&address_str);
+	return address_str;
+}
+
+void	Email_address_view::make_string (std::string* address_str) const
+{
+	address_str->assign(local_part.data, local_part.size);
+	if (!domain.empty()) {
+		address_str->push_back('@');
+		address_str->append(domain.data, domain.size);
 	}
 }
 
@@ -158,4 +358,3 @@ std::string	Email_address::make_string () const
 {
 	return domain.empty() ? local_part : local_part + "@" + domain;
 }
-
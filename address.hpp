@@ -31,13 +31,60 @@
 #ifndef BATV_ADDRESS_HPP
 #define BATV_ADDRESS_HPP
 
+#include "util.hpp"
 #include <string>
 
 namespace batv {
+	struct Email_address;
+	struct Batv_address;
+
+	// Email_address_view and Batv_address_view are like Email_address and
+	// Batv_address, but point into a buffer owned by someone else (usually
+	// the envelope address as given by the MTA), so parsing them doesn't
+	// allocate.  Owned addresses only need to be made when one is emitted.
+	struct Email_address_view {
+		String_view	local_part;
+		String_view	domain;
+
+		Email_address_view () { }
+		Email_address_view (const Email_address&);
+
+		void		parse (String_view);
+		std::string	make_string () const;
+		void		make_string (std::string* out) const;	// like above, but reuses out's buffer
+	};
+
+	struct Batv_address_view {
+		String_view		tag_type;
+		String_view		tag_val;
+		Email_address_view	orig_mailfrom;
+
+		Batv_address_view () { }
+		Batv_address_view (const Batv_address&);
+
+		// Parse the format selected by sub_address_delimiter: sub-address
+		// meta-syntax if it's non-zero, or standard BATV meta-syntax if it's 0
+		bool		parse (const Email_address_view&, char sub_address_delimiter);
+
+		// Parse either format, preferring sub-address meta-syntax (if
+		// sub_address_delimiter is non-zero).  Both are recognized in one pass.
+		enum Format {
+			FORMAT_NONE,
+			FORMAT_STANDARD,
+			FORMAT_SUB_ADDRESS
+		};
+		Format		parse_any (const Email_address_view&, char sub_address_delimiter);
+		std::string	make_string (char sub_address_delimiter) const;
+		void		make_string (std::string* out, char sub_address_delimiter) const;	// like above, but reuses out's buffer
+	};
+
 	struct Email_address {
 		std::string	local_part;
 		std::string	domain;
 
+		Email_address () { }
+		explicit Email_address (const Email_address_view& view) : local_part(view.local_part.str()), domain(view.domain.str()) { }
+
 		void		parse (const char*);
 		std::string	make_string () const;
 		void		clear () { local_part.clear(); domain.clear (); }
@@ -48,12 +95,19 @@ namespace batv {
 		std::string	tag_val;
 		Email_address	orig_mailfrom;
 
+		Batv_address () { }
+		explicit Batv_address (const Batv_address_view& view) : tag_type(view.tag_type.str()), tag_val(view.tag_val.str()), orig_mailfrom(view.orig_mailfrom) { }
+
 		bool		parse (const Email_address&, char sub_address_delimiter);
 		std::string	make_string (char sub_address_delimiter) const;
 	};
 
-	inline bool	is_batv_address (const Email_address& addr, char delim) { return Batv_address().parse(addr, delim); }
+	inline Email_address_view::Email_address_view (const Email_address& address) : local_part(address.local_part), domain(address.domain) { }
+	inline Batv_address_view::Batv_address_view (const Batv_address& address) : tag_type(address.tag_type), tag_val(address.tag_val), orig_mailfrom(address.orig_mailfrom) { }
+
+	inline bool	is_batv_address (const Email_address_view& addr, char delim) { return Batv_address_view().parse(addr, delim); }
 	std::string	canon_address (const char*);
+	String_view	canon_address_view (String_view);	// like canon_address, but returns a view into its argument
 }
 
 #endif
@@ -0,0 +1,82 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "key-map.hpp"
+#include "compiled-key-map.hpp"
+#include "common.hpp"
+#include <iostream>
+#include <fstream>
+#include <unistd.h>
+
+using namespace batv;
+
+namespace {
+	void print_usage (const char* argv0)
+	{
+		std::clog << "Usage: " << argv0 << " KEY_MAP_FILE OUTPUT_FILE" << std::endl;
+	}
+}
+
+int main (int argc, char** argv)
+try {
+	int		flag;
+	while ((flag = getopt(argc, argv, "")) != -1) {
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	if (argc - optind != 2) {
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	const std::string	key_map_file(argv[optind]);
+	const std::string	output_file(argv[optind + 1]);
+
+	if (Compiled_key_map::is_compiled(key_map_file)) {
+		std::clog << argv[0] << ": " << key_map_file << ": Key map is already compiled" << std::endl;
+		return 1;
+	}
+
+	std::ifstream		key_map_in(key_map_file.c_str());
+	if (!key_map_in) {
+		std::clog << argv[0] << ": " << key_map_file << ": Unable to open key map" << std::endl;
+		return 1;
+	}
+
+	Key_map			key_map;
+	load_key_map(key_map, key_map_in);
+	compile_key_map(key_map, output_file);
+	return 0;
+
+} catch (const Initialization_error& e) {
+	std::clog << argv[0] << ": " << e.message << std::endl;
+	return 1;
+}
@@ -28,12 +28,13 @@
  * as that of the covered work.
  */
 
-#include "prvs.hpp"
+#include "tag.hpp"
 #include "config-milter.hpp"
 #include "address.hpp"
 #include "verify.hpp"
 #include "key.hpp"
 #include "common.hpp"
+#include "metrics.hpp"
 #include <iostream>
 #include <signal.h>
 #include <fstream>
@@ -51,38 +52,139 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <pthread.h>
 
 using namespace batv;
 
 namespace {
 	const Config*			config;
 
+	// Longest envelope address the MTA has to accept (RFC 5321, section 4.5.3.1.3).
+	// Address buffers are reserved at this size, so that they don't need to grow
+	// for any compliant address, and only grow (once) for one that's longer.
+	const size_t			MAX_PATH_LENGTH = 256;
+
+	// An envelope recipient that we haven't rejected
+	struct Recipient {
+		std::string		address;
+		bool			verified;		// was it verified at RCPT time? (only done for bounces)
+		Verify_result		result;			// if verified
+		std::string		true_rcpt;		// if verified successfully: the address without its BATV tag
+	};
+
+	// Batv_contexts are recycled by Context_pool, along with the buffers they've
+	// grown, so the message state is kept in storage that's reused from one
+	// message (and connection) to the next instead of being freed.
 	struct Batv_context {
 		// Connection state (applicable to entire SMTP connection):
 		bool			client_is_internal;
+		bool			header_noreply;		// did the MTA agree not to wait for replies to on_header?
 
 		// Message state (applicable only to the current message):
 		unsigned int		num_batv_status_headers;// number of existing X-Batv-Status headers in the message
+		bool			too_many_batv_status_headers;
 		std::string		env_from;		// the message's envelope sender
-		std::string		env_rcpt;		// the message's (last) envelope recipient
-		bool			multiple_recipients;	// true iff message has >1 envelope recipients
+		std::vector<Recipient>	recipients;		// the message's envelope recipients, in order, in the first num_recipients slots
+		size_t			num_recipients;		// (the other slots are left over from earlier messages, for reuse)
+
+		// Scratch space for on_eom:
+		std::string		true_rcpt;
+		std::string		new_env_from;
+		Key			lazy_key;		// where lazy and derived keys are put (see Key_map::copies_keys)
+
+		Batv_context*		next_free;		// next context in Context_pool's free list
+
+		// Where get_key and verify should put a lazy or derived key
+		Key* lazy_key_space () { return config->keys.copies_keys() ? &lazy_key : NULL; }
 
 		Batv_context ()
+		{
+			env_from.reserve(MAX_PATH_LENGTH);
+			true_rcpt.reserve(MAX_PATH_LENGTH);
+			new_env_from.reserve(MAX_PATH_LENGTH);
+			next_free = NULL;
+			reset();
+		}
+
+		void reset ()
 		{
 			client_is_internal = false;
-			num_batv_status_headers = 0;
-			multiple_recipients = false;
+			header_noreply = false;
+			lazy_key.clear();
+			clear_message_state();
 		}
 
 		void clear_message_state ()
 		{
 			num_batv_status_headers = 0;
+			too_many_batv_status_headers = false;
 			env_from.clear();
-			env_rcpt.clear();
-			multiple_recipients = false;
+			num_recipients = 0;
 		}
+
+		// An unused slot for the next recipient, which must be filled in
+		// and then committed by incrementing num_recipients
+		Recipient& next_recipient ()
+		{
+			if (num_recipients == recipients.size()) {
+				recipients.push_back(Recipient());
+				recipients.back().address.reserve(MAX_PATH_LENGTH);
+				recipients.back().true_rcpt.reserve(MAX_PATH_LENGTH);
+			}
+			return recipients[num_recipients];
+		}
+	private:
+		Batv_context (const Batv_context&);
+		Batv_context& operator= (const Batv_context&);
 	};
 
+	// Free list of Batv_contexts, so that in the steady state, connecting doesn't
+	// allocate.  It's shared by all threads, since libmilter gives each connection
+	// a thread of its own, and a per-thread list would die with its thread.
+	// The free list holds as many contexts as there have been concurrent connections.
+	class Context_pool {
+		pthread_mutex_t		mutex;
+		Batv_context*		free_list;
+
+		Context_pool (const Context_pool&);
+		Context_pool& operator= (const Context_pool&);
+	public:
+		Context_pool () : free_list(NULL) { pthread_mutex_init(&mutex, NULL); }
+		~Context_pool ()
+		{
+			while (free_list) {
+				Batv_context*	next = free_list->next_free;
+				delete free_list;
+				free_list = next;
+			}
+			pthread_mutex_destroy(&mutex);
+		}
+
+		Batv_context* get ()
+		{
+			pthread_mutex_lock(&mutex);
+			Batv_context*		ctx = free_list;
+			if (ctx) {
+				free_list = ctx->next_free;
+			}
+			pthread_mutex_unlock(&mutex);
+			return ctx ? ctx : new Batv_context;
+		}
+
+		void put (Batv_context* ctx)
+		{
+			ctx->reset();
+			pthread_mutex_lock(&mutex);
+			ctx->next_free = free_list;
+			free_list = ctx;
+			pthread_mutex_unlock(&mutex);
+		}
+	};
+
+	Context_pool			context_pool;
+
 	sfsistat milter_status (Config::Failure_mode failure_mode)
 	{
 		switch (failure_mode) {
@@ -94,15 +196,87 @@ namespace {
 		return SMFIS_TEMPFAIL;
 	}
 
+	// The actions we take on messages (all of which are needed at one time or another)
+	const unsigned long		MILTER_ACTIONS = SMFIF_CHGFROM | SMFIF_ADDHDRS | SMFIF_CHGHDRS | SMFIF_DELRCPT | SMFIF_ADDRCPT;
+
+	sfsistat on_negotiate (SMFICTX* ctx, unsigned long actions, unsigned long steps, unsigned long, unsigned long,
+				unsigned long* our_actions, unsigned long* our_steps, unsigned long* our_reserved2, unsigned long* our_reserved3)
+	{
+		Callback_timer		timer(CALLBACK_NEGOTIATE);
+		if (config->debug) std::cerr << "on_negotiate " << ctx << '\n';
+
+		if ((actions & MILTER_ACTIONS) != MILTER_ACTIONS) {
+			std::clog << "on_negotiate: MTA does not offer the actions we need" << std::endl;
+			return SMFIS_REJECT;
+		}
+
+		// Created here rather than in on_connect, since on_connect is skipped in verify-only mode
+		Batv_context*		batv_ctx = context_pool.get();
+		if (smfi_setpriv(ctx, batv_ctx) == MI_FAILURE) {
+			// Carry on: the other callbacks apply on-internal-error when they find no context
+			context_pool.put(batv_ctx);
+			batv_ctx = NULL;
+			std::clog << "on_negotiate: smfi_setpriv failed" << std::endl;
+		}
+
+		// Skip the protocol steps we have no callbacks for, or that the mode doesn't need:
+		// the client address and auth status only matter when signing, and the headers
+		// (which are only counted so stale X-Batv-Status headers can be removed) only when verifying.
+		unsigned long		skip_steps = SMFIP_NOHELO | SMFIP_NOEOH | SMFIP_NOBODY | SMFIP_NOUNKNOWN | SMFIP_NODATA;
+		if (!config->do_sign) {
+			skip_steps |= SMFIP_NOCONNECT;
+		}
+		if (!config->do_verify) {
+			skip_steps |= SMFIP_NOHDRS;
+		}
+		*our_steps = steps & skip_steps;
+		if (*our_steps & SMFIP_NOCONNECT) {
+			// on_connect, which counts the other connections, won't run
+			count_metric(COUNTER_CONNECTIONS_UNCHECKED);
+		}
+
+		// on_header never rejects by itself, so the MTA needn't wait for its reply.
+		// Every other callback we keep may have to reply with a rejection.
+		// Without a context there's nowhere to record header_noreply, so on_header
+		// must then be able to reply (see on_header).
+		if (batv_ctx && config->do_verify && (steps & SMFIP_NR_HDR)) {
+			*our_steps |= SMFIP_NR_HDR;
+			batv_ctx->header_noreply = true;
+		}
+
+		*our_actions = MILTER_ACTIONS;
+		*our_reserved2 = 0;
+		*our_reserved3 = 0;
+
+		// Ask for just the one macro we use, instead of the MTA's default lists
+		if (actions & SMFIF_SETSYMLIST) {
+			*our_actions |= SMFIF_SETSYMLIST;
+			const int	stages[] = { SMFIM_CONNECT, SMFIM_HELO, SMFIM_ENVFROM, SMFIM_ENVRCPT, SMFIM_DATA, SMFIM_EOH, SMFIM_EOM };
+			for (size_t i = 0; i < sizeof(stages) / sizeof(stages[0]); ++i) {
+				const char*	macros = stages[i] == SMFIM_ENVFROM && config->do_sign ? "{auth_authen}" : "";
+				if (smfi_setsymlist(ctx, stages[i], const_cast<char*>(macros)) == MI_FAILURE) {
+					std::clog << "on_negotiate: smfi_setsymlist failed" << std::endl;
+				}
+			}
+		}
+
+		return SMFIS_CONTINUE;
+	}
+
 	sfsistat on_connect (SMFICTX* ctx, char* hostname, struct sockaddr* hostaddr)
 	{
+		Callback_timer		timer(CALLBACK_CONNECT);
 		if (config->debug) std::cerr << "on_connect " << ctx << '\n';
 
-		Batv_context*		batv_ctx = new Batv_context;
-		if (smfi_setpriv(ctx, batv_ctx) == MI_FAILURE) {
-			delete batv_ctx;
-			std::clog << "on_connect: smfi_setpriv failed" << std::endl;
-			return milter_status(config->on_internal_error);
+		Batv_context*		batv_ctx = static_cast<Batv_context*>(smfi_getpriv(ctx));
+		if (batv_ctx == NULL) {
+			// The MTA didn't negotiate (old protocol version)
+			batv_ctx = context_pool.get();
+			if (smfi_setpriv(ctx, batv_ctx) == MI_FAILURE) {
+				context_pool.put(batv_ctx);
+				std::clog << "on_connect: smfi_setpriv failed" << std::endl;
+				return milter_status(config->on_internal_error);
+			}
 		}
 
 		if (!hostaddr) {
@@ -119,12 +293,14 @@ namespace {
 		} else {
 			// Unsupported socket family. Can't tell if client is internal.
 		}
+		count_metric(batv_ctx->client_is_internal ? COUNTER_CONNECTIONS_INTERNAL : COUNTER_CONNECTIONS_EXTERNAL);
 
 		return SMFIS_CONTINUE;
 	}
 
 	sfsistat on_envfrom (SMFICTX* ctx, char** args)
 	{
+		Callback_timer		timer(CALLBACK_ENVFROM);
 		if (config->debug) std::cerr << "on_envfrom " << ctx << '\n';
 
 		Batv_context*		batv_ctx = static_cast<Batv_context*>(smfi_getpriv(ctx));
@@ -146,6 +322,7 @@ namespace {
 
 	sfsistat on_envrcpt (SMFICTX* ctx, char** args)
 	{
+		Callback_timer		timer(CALLBACK_ENVRCPT);
 		if (config->debug) std::cerr << "on_envrcpt " << ctx << '\n';
 
 		Batv_context*		batv_ctx = static_cast<Batv_context*>(smfi_getpriv(ctx));
@@ -154,19 +331,56 @@ namespace {
 			return milter_status(config->on_internal_error);
 		}
 
-		// Make note of the envelope recipient
-		batv_ctx->multiple_recipients = !batv_ctx->env_rcpt.empty();
-		batv_ctx->env_rcpt = args[0];
+		// Make note of the envelope recipient (committed below, unless it's rejected)
+		Recipient&		rcpt(batv_ctx->next_recipient());
+		rcpt.address = args[0];
+		rcpt.verified = false;
+		rcpt.result = VERIFY_NONE;
+		rcpt.true_rcpt.clear();
+
+		// Verify bounces now, so that an invalid one can be refused before its
+		// body is sent.  Each recipient is verified on its own; a recipient we
+		// reject isn't added to the message, so doesn't count as one of many.
+		if (config->do_verify && canon_address_view(batv_ctx->env_from).empty()) {
+			if (batv_ctx->num_recipients > 0) {
+				rcpt.result = VERIFY_MULTIPLE_RCPT;
+			} else {
+				Email_address_view	env_rcpt;
+				Email_address_view	true_rcpt;
+				env_rcpt.parse(canon_address_view(rcpt.address));
+				rcpt.result = batv::verify(env_rcpt, &true_rcpt, *config, batv_ctx->lazy_key_space());
+				if (rcpt.result == VERIFY_SUCCESS) {
+					true_rcpt.make_string(&rcpt.true_rcpt);
+				}
+			}
+			rcpt.verified = true;
+
+			// Only rejecting and tempfailing can be done to a single recipient;
+			// anything else is left to on_eom, as for other mail
+			const Config::Failure_mode	failure_mode = rcpt.result == VERIFY_ERROR ? config->on_internal_error : config->on_invalid;
+			if ((rcpt.result == VERIFY_MISSING || rcpt.result == VERIFY_BAD_SIGNATURE ||
+					rcpt.result == VERIFY_MULTIPLE_RCPT || rcpt.result == VERIFY_ERROR) &&
+					(failure_mode == Config::FAILURE_REJECT || failure_mode == Config::FAILURE_TEMPFAIL)) {
+				count_verify_result(rcpt.result);
+				count_metric(COUNTER_RCPT_REJECTED);
+				return milter_status(failure_mode);
+			}
+		}
+
+		++batv_ctx->num_recipients;
 
 		return SMFIS_CONTINUE;
 	}
 
 	sfsistat on_header (SMFICTX* ctx, char* name, char* value)
 	{
+		Callback_timer		timer(CALLBACK_HEADER);
 		if (config->debug) std::cerr << "on_header " << ctx << '\n';
 
 		Batv_context*		batv_ctx = static_cast<Batv_context*>(smfi_getpriv(ctx));
 		if (batv_ctx == NULL) {
+			// NR_HDR is only negotiated when on_negotiate stored a context, so the MTA is
+			// waiting for this reply.  (on_eom applies on-internal-error too, finding no context.)
 			std::clog << "on_header: smfi_getpriv failed" << std::endl;
 			return milter_status(config->on_internal_error);
 		}
@@ -176,18 +390,22 @@ namespace {
 			++batv_ctx->num_batv_status_headers;
 			if (batv_ctx->num_batv_status_headers == 0) {
 				// integer overflow; rather unlikely since a message with 4 billion X-Batv-Status headers would be enormous
-				std::clog << "on_header: rejecting incoming message because it has too many existing X-Batv-Status headers, which is likely malicious" << std::endl;
-				return SMFIS_REJECT;
+				// (rejected in on_eom, since the MTA may not be waiting for our reply)
+				batv_ctx->too_many_batv_status_headers = true;
 			}
 		}
 
-		return SMFIS_CONTINUE;
+		return batv_ctx->header_noreply ? SMFIS_NOREPLY : SMFIS_CONTINUE;
 	}
 
+	// *true_rcpt is the recipient without its BATV tag (if successful)
 	Verify_result verify (Batv_context* batv_ctx, std::string* true_rcpt)
 	{
-		if (batv_ctx->multiple_recipients) {
-			true_rcpt->clear();
+		true_rcpt->clear();
+		if (batv_ctx->num_recipients == 0) {
+			return VERIFY_NONE;
+		}
+		if (batv_ctx->num_recipients > 1) {
 			// This can't be a valid bounce because it has more than one recipient.
 			// Section 4.5.5 of RFC5321 states that messages with a null reverse-path
 			// "are notifications about a previous message, and they are sent to the
@@ -197,14 +415,27 @@ namespace {
 			return VERIFY_MULTIPLE_RCPT;
 		}
 
-		Email_address		env_rcpt;
-		env_rcpt.parse(canon_address(batv_ctx->env_rcpt.c_str()).c_str());
+		const Recipient&	rcpt(batv_ctx->recipients[0]);
+		if (rcpt.verified) {
+			// Already verified in on_envrcpt
+			*true_rcpt = rcpt.true_rcpt;
+			return rcpt.result;
+		}
+
+		Email_address_view	env_rcpt;
+		Email_address_view	true_rcpt_view;
+		env_rcpt.parse(canon_address_view(rcpt.address));
 
-		return batv::verify(env_rcpt, true_rcpt, *config);
+		const Verify_result	result = batv::verify(env_rcpt, &true_rcpt_view, *config, batv_ctx->lazy_key_space());
+		if (result == VERIFY_SUCCESS) {
+			true_rcpt_view.make_string(true_rcpt);
+		}
+		return result;
 	}
 
 	sfsistat on_eom (SMFICTX* ctx)
 	{
+		Callback_timer		timer(CALLBACK_EOM);
 		if (config->debug) std::cerr << "on_eom " << ctx << '\n';
 
 		Batv_context*		batv_ctx = static_cast<Batv_context*>(smfi_getpriv(ctx));
@@ -212,8 +443,15 @@ namespace {
 			std::clog << "on_eom: smfi_getpriv failed" << std::endl;
 			return milter_status(config->on_internal_error);
 		}
+		count_metric(COUNTER_MESSAGES);
 
 		if (config->do_verify) {
+			if (batv_ctx->too_many_batv_status_headers) {
+				std::clog << "on_eom: rejecting incoming message because it has too many existing X-Batv-Status headers, which is likely malicious" << std::endl;
+				batv_ctx->clear_message_state();
+				return SMFIS_REJECT;
+			}
+
 			// Remove all existing X-Batv-Status headers from the message.
 			// This is to prevent a malicious sender from trying to fake us out.
 			while (batv_ctx->num_batv_status_headers > 0) {
@@ -224,10 +462,11 @@ namespace {
 				}
 			}
 
-			const bool		is_bounce = canon_address(batv_ctx->env_from.c_str()).empty(); // bounces have null envelope senders (TODO: there should be configurable bounce detection logic)
+			const bool		is_bounce = canon_address_view(batv_ctx->env_from).empty(); // bounces have null envelope senders (TODO: there should be configurable bounce detection logic)
 
-			std::string		true_rcpt;
+			std::string&		true_rcpt(batv_ctx->true_rcpt);
 			Verify_result		result = verify(batv_ctx, &true_rcpt);
+			count_verify_result(result);
 			const char*		batv_status = NULL;
 			sfsistat		our_milter_status = SMFIS_ACCEPT;
 
@@ -262,14 +501,14 @@ namespace {
 
 			if (result == VERIFY_SUCCESS) {
 				// Add a X-Batv-Delivered-To header containing the envelope recipient, pre-rewrite
-				if (smfi_addheader(ctx, const_cast<char*>("X-Batv-Delivered-To"), const_cast<char*>(batv_ctx->env_rcpt.c_str())) == MI_FAILURE) { // TODO: I should probably be filling this with the *canonicalized* env recipient, since you don't see angle brackets in the normal Delivered-To header.
+				if (smfi_addheader(ctx, const_cast<char*>("X-Batv-Delivered-To"), const_cast<char*>(batv_ctx->recipients[0].address.c_str())) == MI_FAILURE) { // TODO: I should probably be filling this with the *canonicalized* env recipient, since you don't see angle brackets in the normal Delivered-To header.
 					std::clog << "on_eom: smfi_addheader failed (2)" << std::endl;
 					batv_ctx->clear_message_state();
 					return milter_status(config->on_internal_error);
 				}
 
 				// Restore the recipient to the original value
-				if (smfi_delrcpt(ctx, const_cast<char*>(batv_ctx->env_rcpt.c_str())) == MI_FAILURE) {
+				if (smfi_delrcpt(ctx, const_cast<char*>(batv_ctx->recipients[0].address.c_str())) == MI_FAILURE) {
 					std::clog << "on_eom: smfi_delrcpt failed" << std::endl;
 					batv_ctx->clear_message_state();
 					return milter_status(config->on_internal_error);
@@ -283,20 +522,40 @@ namespace {
 		}
 
 		if (config->do_sign && batv_ctx->client_is_internal) {
-			const Key*	sender_key = NULL;
-			Email_address	env_from;
-			env_from.parse(canon_address(batv_ctx->env_from.c_str()).c_str());
-			if (!is_batv_address(env_from, config->sub_address_delimiter) &&
-					(sender_key = config->get_key(env_from.make_string())) != NULL) {
+			const Key*		sender_key = NULL;
+			Email_address_view	env_from;
+			env_from.parse(canon_address_view(batv_ctx->env_from));
+			if (!is_batv_address(env_from, config->sub_address_delimiter)) {
+				try {
+					sender_key = config->get_key(env_from, batv_ctx->lazy_key_space());
+				} catch (const Initialization_error& e) {
+					// A lazy key couldn't be loaded
+					std::clog << "on_eom: " << e.message << std::endl;
+					batv_ctx->clear_message_state();
+					return milter_status(config->on_internal_error);
+				}
+			}
+			if (sender_key) {
 				// Message from internal sender who uses BATV -> rewrite the envelope sender to a BATV address.
 				// (We only do this if the envelope sender isn't already a BATV address)
-				Batv_address new_sender(prvs_generate(env_from, config->address_lifetime, *sender_key));
-
-				if (smfi_chgfrom(ctx, const_cast<char*>(new_sender.make_string(config->sub_address_delimiter).c_str()), NULL) == MI_FAILURE) {
+				const Tag_algorithm&	algorithm(*config->tag_algorithm);
+				char			tag_val[MAX_TAG_VAL_LENGTH];
+				algorithm.generate_tag(tag_val, env_from.local_part.data, env_from.local_part.size,
+						       env_from.domain.data, env_from.domain.size,
+						       config->address_lifetime, *sender_key);
+
+				Batv_address_view	new_sender;
+				new_sender.tag_type = String_view(algorithm.tag_type, algorithm.tag_type_len);
+				new_sender.tag_val = String_view(tag_val, algorithm.tag_val_len);
+				new_sender.orig_mailfrom = env_from;
+
+				new_sender.make_string(&batv_ctx->new_env_from, config->sub_address_delimiter);
+				if (smfi_chgfrom(ctx, const_cast<char*>(batv_ctx->new_env_from.c_str()), NULL) == MI_FAILURE) {
 					std::clog << "on_eom: smfi_chgfrom failed" << std::endl;
 					batv_ctx->clear_message_state();
 					return milter_status(config->on_internal_error);
 				}
+				count_metric(COUNTER_SIGNATURES);
 			}
 		}
 
@@ -307,6 +566,7 @@ namespace {
 
 	sfsistat on_abort (SMFICTX* ctx)
 	{
+		Callback_timer		timer(CALLBACK_ABORT);
 		if (config->debug) std::cerr << "on_abort " << ctx << '\n';
 		if (Batv_context* batv_ctx = static_cast<Batv_context*>(smfi_getpriv(ctx))) {
 			batv_ctx->clear_message_state();
@@ -315,14 +575,60 @@ namespace {
 	}
 	sfsistat on_close (SMFICTX* ctx)
 	{
+		Callback_timer		timer(CALLBACK_CLOSE);
 		if (config->debug) std::cerr << "on_close " << ctx << '\n';
 
-		delete static_cast<Batv_context*>(smfi_getpriv(ctx));
+		if (Batv_context* batv_ctx = static_cast<Batv_context*>(smfi_getpriv(ctx))) {
+			context_pool.put(batv_ctx);
+		}
 		smfi_setpriv(ctx, NULL); // this shouldn't matter because we never access the private
 					 // data again but libmilter complains if it's not NULL'ed out.
 		return SMFIS_CONTINUE; // return value doesn't matter in on_close()
 	}
 
+	// Remove the UNIX domain socket at path if it's left over from a process that's gone
+	void remove_stale_socket (const char* path)
+	{
+		struct stat status;
+		if (lstat(path, &status) == 0) {
+			if (!S_ISSOCK(status.st_mode)) {
+				throw Initialization_error(std::string(path) + ": socket file already exists (as a non-socket file)");
+			}
+			if (unix_socket_is_alive(path, 5000)) {
+				throw Initialization_error(std::string(path) + ": socket file already exists and is in use by a running process");
+			}
+			if (unlink(path) == -1) {
+				throw Initialization_error(std::string(path) + ": could not remove stale socket file: " + strerror(errno));
+			}
+		} else if (errno != ENOENT) {
+			throw Initialization_error(std::string(path) + ": " + strerror(errno));
+		}
+	}
+
+	int open_stats_socket (const std::string& path)
+	{
+		struct sockaddr_un	addr;
+		if (path.size() >= sizeof(addr.sun_path)) {
+			throw Initialization_error(path + ": stats socket path is too long");
+		}
+		std::memset(&addr, '\0', sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		std::strcpy(addr.sun_path, path.c_str()); // safe - length of path checked above
+
+		remove_stale_socket(path.c_str());
+
+		const int		sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (sockfd == -1) {
+			throw Initialization_error(std::string("socket: ") + strerror(errno));
+		}
+		if (bind(sockfd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) == -1 || listen(sockfd, 16) == -1) {
+			const int	err = errno;
+			close(sockfd);
+			throw Initialization_error(path + ": " + strerror(err));
+		}
+		return sockfd;
+	}
+
 	const char* get_socket_path (const std::string& conn_spec)
 	{
 		if (conn_spec.substr(0, 5) == "unix:") {
@@ -362,7 +668,7 @@ try {
 
 	milter_desc.xxfi_name = const_cast<char*>("batv-milter");
 	milter_desc.xxfi_version = SMFI_VERSION;
-	milter_desc.xxfi_flags = SMFIF_CHGFROM | SMFIF_ADDHDRS | SMFIF_CHGHDRS | SMFIF_DELRCPT | SMFIF_ADDRCPT;
+	milter_desc.xxfi_flags = MILTER_ACTIONS;
 	milter_desc.xxfi_connect = on_connect;
 	milter_desc.xxfi_helo = NULL;
 	milter_desc.xxfi_envfrom = on_envfrom;
@@ -375,7 +681,7 @@ try {
 	milter_desc.xxfi_close = on_close;
 	milter_desc.xxfi_unknown = NULL;
 	milter_desc.xxfi_data = NULL;
-	milter_desc.xxfi_negotiate = NULL;
+	milter_desc.xxfi_negotiate = on_negotiate;
 
 	std::string		conn_spec;
 	if (config->socket_spec[0] == '/') {
@@ -386,24 +692,7 @@ try {
 	}
 
 	if (const char* path = get_socket_path(conn_spec)) {
-		struct stat status;
-		if (lstat(path, &status) == 0) {
-			if (!S_ISSOCK(status.st_mode)) {
-				std::clog << path << ": socket file already exists (as a non-socket file)" << std::endl;
-				return 1;
-			}
-			if (unix_socket_is_alive(path, 5000)) {
-				std::clog << path << ": socket file already exists and is in use by a running process" << std::endl;
-				return 1;
-			}
-			if (unlink(path) == -1) {
-				std::clog << path << ": could not remove stale socket file: " << strerror(errno) << std::endl;
-				return 1;
-			}
-		} else if (errno != ENOENT) {
-			std::clog << path << ": " << strerror(errno) << std::endl;
-			return 1;
-		}
+		remove_stale_socket(path);
 	}
 
 	drop_privileges(config->user_name, config->group_name);
@@ -415,11 +704,17 @@ try {
 	if (config->socket_mode != -1) {
 		// We don't have much control over the permissions of the socket, so
 		// approximate it by setting a umask that should result in the desired
-		// permissions on the socket.  This program doesn't create any other
-		// files so this shouldn't have any undesired side-effects.
+		// permissions on the socket.  The only other files this program
+		// creates are the stats socket and file, which should get the same
+		// permissions anyways.
 		umask(~config->socket_mode & 0777);
 	}
 
+	if (!config->stats_socket.empty() || !config->stats_file.empty()) {
+		const int	stats_fd = config->stats_socket.empty() ? -1 : open_stats_socket(config->stats_socket);
+		start_metrics_thread(stats_fd, config->stats_file, config->stats_interval);
+	}
+
 	smfi_setdbg(config->debug);
 
 	bool			ok = true;
@@ -444,6 +739,9 @@ try {
 	if (const char* path = get_socket_path(conn_spec)) {
 		unlink(path);
 	}
+	if (!config->stats_socket.empty()) {
+		unlink(config->stats_socket.c_str());
+	}
 	if (!config->pid_file.empty()) {
 		unlink(config->pid_file.c_str());
 	}
@@ -28,12 +28,11 @@
  * as that of the covered work.
  */
 
-#include "prvs.hpp"
-#include "key.hpp"
+#include "tag.hpp"
+#include "key-map.hpp"
 #include "common.hpp"
 #include "address.hpp"
 #include <iostream>
-#include <fstream>
 #include <unistd.h>
 #include <errno.h>
 #include <cstring>
@@ -52,6 +51,7 @@ namespace {
 		std::clog << " -K KEY_MAP_FILE    -- path to key map file (default: ~/.batv-keys)" << std::endl;
 		std::clog << " -l LIFETIME        -- lifetime, in days, of BATV address (default: 7)" << std::endl;
 		std::clog << " -d SUB_ADDR_DELIM  -- sub address delimiter (default: +)" << std::endl;
+		std::clog << " -t TAG_TYPE        -- tag type: prvs or prvs-sha256 (default: prvs)" << std::endl;
 	}
 }
 
@@ -59,13 +59,14 @@ int main (int argc, char** argv)
 try {
 	char		sub_address_delimiter = '+';
 	unsigned int	address_lifetime = 7;
+	const Tag_algorithm*	tag_algorithm = &tag_algorithms[TAG_PRVS];
 	Key		key;
 	std::string	key_file;
 	Key_map		key_map;
 	std::string	key_map_file;
 
 	int		flag;
-	while ((flag = getopt(argc, argv, "k:K:l:d:")) != -1) {
+	while ((flag = getopt(argc, argv, "k:K:l:d:t:")) != -1) {
 		switch (flag) {
 		case 'k':
 			key_file = optarg;
@@ -83,6 +84,12 @@ try {
 			}
 			sub_address_delimiter = optarg[0];
 			break;
+		case 't':
+			if (!(tag_algorithm = find_tag_algorithm(optarg))) {
+				std::clog << argv[0] << ": " << optarg << ": unknown tag type (as specified by -t); should be prvs or prvs-sha256" << std::endl;
+				return 1;
+			}
+			break;
 		default:
 			print_usage(argv[0]);
 			return 2;
@@ -99,6 +106,11 @@ try {
 		return 1;
 	}
 
+	if (!tag_type_usable_with_delimiter(*tag_algorithm, sub_address_delimiter)) {
+		std::clog << argv[0] << ": tag type " << tag_algorithm->tag_type << " (as specified by -t) cannot be used with sub address delimiter " << sub_address_delimiter << " (as specified by -d) because it contains the delimiter" << std::endl;
+		return 1;
+	}
+
 	// Load the key
 	check_personal_key_path(key_file, ".batv-key");
 	check_personal_key_path(key_map_file, ".batv-keys");
@@ -114,12 +126,14 @@ try {
 		load_key(key, key_file);
 	}
 	if (!key_map_file.empty()) {
-		std::ifstream	key_map_in(key_map_file.c_str());
-		load_key_map(key_map, key_map_in);
+		// Only one key is needed, so only load that one
+		key_map.set_lazy(1);
+		load_key_map_file(key_map, key_map_file);
 	}
 	
 	// Determine what key to use to sign this message
-	const Key*		use_key = get_key(key_map, argv[optind], !key.empty() ? &key : NULL);
+	Key			lazy_key;
+	const Key*		use_key = get_key(key_map, argv[optind], !key.empty() ? &key : NULL, &lazy_key);
 	if (!use_key) {
 		std::clog << argv[0] << ": " << argv[optind] << ": No key available for this sender" << std::endl;
 		return 1;
@@ -133,7 +147,7 @@ try {
 		return 1;
 	}
 
-	std::cout << prvs_generate(from_address, address_lifetime, *use_key).make_string(sub_address_delimiter) << std::endl;
+	std::cout << tag_generate(*tag_algorithm, from_address, address_lifetime, *use_key).make_string(sub_address_delimiter) << std::endl;
 	return 0;
 
 } catch (const Initialization_error& e) {
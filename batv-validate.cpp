@@ -35,7 +35,6 @@
 #include "config.hpp"
 #include "verify.hpp"
 #include <iostream>
-#include <fstream>
 #include <unistd.h>
 #include <errno.h>
 #include <cstring>
@@ -172,10 +171,10 @@ namespace {
 				// Remove this header to prevent malicious senders from faking us out
 
 			} else if (result != VERIFY_SUCCESS && strcasecmp(name.c_str(), config.rcpt_header.c_str()) == 0) {
-				Email_address		rcpt_to;
-				rcpt_to.parse(canon_address(after_ws(value.c_str())).c_str());
+				Email_address_view	rcpt_to;
+				rcpt_to.parse(canon_address_view(String_view(after_ws(value.c_str()))));
 
-				std::string		true_rcpt;
+				Email_address_view	true_rcpt;
 				Verify_result		this_result = verify(rcpt_to, &true_rcpt, config);
 
 				if (this_result != VERIFY_NONE) {
@@ -184,7 +183,13 @@ namespace {
 
 				if (this_result == VERIFY_SUCCESS) {
 					// Restore original envelope recipient
-					out << name << ": " << true_rcpt << '\n';
+					out << name << ": ";
+					out.write(true_rcpt.local_part.data, true_rcpt.local_part.size);
+					if (!true_rcpt.domain.empty()) {
+						out << '@';
+						out.write(true_rcpt.domain.data, true_rcpt.domain.size);
+					}
+					out << '\n';
 
 					out << "X-Batv-Status: valid\n";
 
@@ -291,8 +296,9 @@ try {
 		load_key(config.default_key, key_file);
 	}
 	if (!key_map_file.empty()) {
-		std::ifstream	key_map_in(key_map_file.c_str());
-		load_key_map(config.keys, key_map_in);
+		// Only a few keys are ever needed, so only load those
+		config.keys.set_lazy(16);
+		load_key_map_file(config.keys, key_map_file);
 	}
 
 	// Do the validation/filtering
@@ -323,11 +329,13 @@ try {
 		// through several mail servers.  We check each one until one validates successfully.
 		// Buffer errors in an ostringstream and only write it to stderr if all the addresses
 		// fail to validate.  The exit code will reflect the status of the last address.
-		std::ostringstream	errors;
-		int			status = 0;
+		std::ostringstream		errors;
+		int				status = 0;
+		std::vector<std::string>	true_rcpts;
+		std::vector<Verify_result>	results(verify_many(rcpt_tos, &true_rcpts, config));
 		for (size_t i = 0; i < rcpt_tos.size(); ++i) {
-			std::string	true_rcpt;
-			Verify_result	result = verify(rcpt_tos[i], &true_rcpt, config);
+			const std::string&	true_rcpt(true_rcpts[i]);
+			Verify_result		result = results[i];
 			if (result == VERIFY_NONE) {
 				errors << argv[0] << ": " << true_rcpt << ": No key available for this sender" << std::endl;
 				continue;
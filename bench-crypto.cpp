@@ -0,0 +1,592 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+// Microbenchmarks for the crypto primitives and the prvs functions.
+// Build with 'make bench-crypto'.  Results are printed to stdout as JSON,
+// one object per benchmark and thread count, so runs from different builds
+// can be diffed.  With -c (or 'make check'), it checks the implementations
+// against each other instead.
+
+#include "prvs.hpp"
+#include "tag.hpp"
+#include "key.hpp"
+#include "address.hpp"
+#include "hmac.hpp"
+#include "sha1.hpp"
+#include "sha1-multi.hpp"
+#include "sha256.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define BATV_BENCH_HAVE_TSC
+#endif
+
+using namespace batv;
+
+namespace {
+	// Lengths of the original mailfrom (local part plus "@example.com").
+	// 51 is the longest that fits in a single HMAC block.
+	const size_t		address_lengths[] = { 16, 32, 51, 64, 128, 256 };
+	const size_t		num_address_lengths = sizeof(address_lengths) / sizeof(address_lengths[0]);
+	const size_t		BATCH_SIZE = 64;	// addresses per prvs_validate_many call
+	const unsigned int	LIFETIME = 7;
+
+	// Fixtures, set up before any benchmark runs and read-only afterwards
+	Key			bench_key;
+	Email_address		addresses[num_address_lengths];
+	Batv_address		batv_addresses[NUM_TAG_TYPES][num_address_lengths];
+
+	volatile unsigned int	sink;	// results are folded into this so they aren't optimized away
+
+	struct Benchmark {
+		const char*		name;
+		const Tag_algorithm*	algorithm;	// NULL if not applicable
+		size_t			address_length;	// 0 if not applicable
+		size_t			bytes_per_op;	// for throughput; 0 if not applicable
+		void			(*run) (const Benchmark&, unsigned long iterations);
+		const char*		(*implementation) ();	// name of the implementation being measured
+	};
+
+	const char*	sha1_implementation () { return crypto::Sha1_state::implementation_name(crypto::Sha1_state::get_implementation()); }
+	const char*	sha256_implementation () { return crypto::Sha256_state::implementation_name(crypto::Sha256_state::get_implementation()); }
+	const char*	sha1_multi_implementation ()
+	{
+		static char	name[16];
+		std::snprintf(name, sizeof(name), "%u-lane", crypto::Sha1_multi::lanes());
+		return name;
+	}
+	const char*	tag_implementation (const Tag_algorithm* algorithm)
+	{
+		return algorithm == &tag_algorithms[TAG_PRVS_SHA256] ? sha256_implementation() : sha1_implementation();
+	}
+
+	size_t		address_index (size_t address_length)
+	{
+		size_t	i = 0;
+		while (address_lengths[i] != address_length) {
+			++i;
+		}
+		return i;
+	}
+
+	void		run_sha1_compress (const Benchmark&, unsigned long iterations)
+	{
+		unsigned char		block[crypto::Sha1_state::BLOCK_LENGTH];
+		std::memset(block, 'x', sizeof(block));
+
+		crypto::Sha1_state	state;
+		while (iterations--) {
+			state.transform(block);
+		}
+		sink += state.get_words()[0];
+	}
+
+	void		run_sha256_compress (const Benchmark&, unsigned long iterations)
+	{
+		unsigned char		block[crypto::Sha256_state::BLOCK_LENGTH];
+		std::memset(block, 'x', sizeof(block));
+
+		crypto::Sha256_state	state;
+		while (iterations--) {
+			state.transform(block);
+		}
+		sink += state.get_words()[0];
+	}
+
+	void		run_sha1_multi (const Benchmark&, unsigned long iterations)
+	{
+		typedef crypto::Sha1_multi	Sha1_multi;
+
+		// One op is one block; each compute() call hashes one block per job
+		unsigned char		block[Sha1_multi::BLOCK_LENGTH];
+		std::memset(block, 'x', sizeof(block));
+
+		Sha1_multi::Job		jobs[Sha1_multi::MAX_LANES];
+		const size_t		num_jobs = Sha1_multi::lanes();
+		for (unsigned long n = 0; n < iterations; n += num_jobs) {
+			for (size_t j = 0; j < num_jobs; ++j) {
+				Sha1_multi::init(jobs[j].state);
+				jobs[j].data = block;
+				jobs[j].num_blocks = 1;
+			}
+			Sha1_multi::compute(jobs, num_jobs);
+			sink += jobs[0].state[0];
+		}
+	}
+
+	void		run_hmac_setup (const Benchmark&, unsigned long iterations)
+	{
+		const std::vector<unsigned char>&	key_bytes(bench_key.get_bytes());
+		while (iterations--) {
+			crypto::Hmac_key<crypto::Sha1>	hmac_key(&key_bytes[0], key_bytes.size());
+			sink += hmac_key.get_inner().get_state().get_words()[0];
+		}
+	}
+
+	void		run_prvs_generate (const Benchmark& bench, unsigned long iterations)
+	{
+		const Email_address&	address(addresses[address_index(bench.address_length)]);
+		char			tag_val[MAX_TAG_VAL_LENGTH];
+
+		while (iterations--) {
+			bench.algorithm->generate_tag(tag_val, address.local_part.data(), address.local_part.size(),
+						      address.domain.data(), address.domain.size(), LIFETIME, bench_key);
+			sink += tag_val[9];
+		}
+	}
+
+	void		run_prvs_validate (const Benchmark& bench, unsigned long iterations)
+	{
+		const Batv_address&	address(batv_addresses[bench.algorithm - tag_algorithms][address_index(bench.address_length)]);
+
+		while (iterations--) {
+			sink += bench.algorithm->validate_tag(address.tag_val.data(), address.tag_val.size(),
+							      address.orig_mailfrom.local_part.data(), address.orig_mailfrom.local_part.size(),
+							      address.orig_mailfrom.domain.data(), address.orig_mailfrom.domain.size(),
+							      LIFETIME, bench_key);
+		}
+	}
+
+	void		run_prvs_validate_many (const Benchmark& bench, unsigned long iterations)
+	{
+		// One op is one address
+		const std::vector<Batv_address_view>	batch(BATCH_SIZE, Batv_address_view(batv_addresses[TAG_PRVS][address_index(bench.address_length)]));
+		const std::vector<const Key*>	keys(BATCH_SIZE, &bench_key);
+
+		for (unsigned long n = 0; n < iterations; n += BATCH_SIZE) {
+			sink += prvs_validate_many(&batch[0], &keys[0], BATCH_SIZE, LIFETIME)[0];
+		}
+	}
+
+	double		now ()
+	{
+		struct timespec	ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+	}
+
+	unsigned long long	read_tsc ()
+	{
+#ifdef BATV_BENCH_HAVE_TSC
+		return __rdtsc();
+#else
+		return 0;
+#endif
+	}
+
+	struct Thread_run {
+		const Benchmark*	bench;
+		unsigned long		iterations;
+		double			seconds;
+		unsigned long long	cycles;
+	};
+
+	void*		thread_main (void* arg)
+	{
+		Thread_run*		run = static_cast<Thread_run*>(arg);
+		const double		start_time = now();
+		const unsigned long long start_tsc = read_tsc();
+		run->bench->run(*run->bench, run->iterations);
+		run->cycles = read_tsc() - start_tsc;
+		run->seconds = now() - start_time;
+		return NULL;
+	}
+
+	struct Measurement {
+		double			ns_per_op;	// per thread
+		double			cycles_per_op;	// per thread, in TSC ticks
+		double			ops_per_sec;	// across all threads
+	};
+
+	Measurement	measure (const Benchmark& bench, unsigned int num_threads, unsigned long iterations)
+	{
+		std::vector<Thread_run>	runs(num_threads);
+		std::vector<pthread_t>	threads(num_threads);
+		const double		start_time = now();
+
+		for (unsigned int i = 0; i < num_threads; ++i) {
+			runs[i].bench = &bench;
+			runs[i].iterations = iterations;
+			if (num_threads == 1) {
+				thread_main(&runs[i]);
+			} else if (pthread_create(&threads[i], NULL, thread_main, &runs[i]) != 0) {
+				std::perror("pthread_create");
+				std::exit(1);
+			}
+		}
+		if (num_threads > 1) {
+			for (unsigned int i = 0; i < num_threads; ++i) {
+				pthread_join(threads[i], NULL);
+			}
+		}
+		const double		wall_seconds = now() - start_time;
+
+		Measurement		m = { 0, 0, 0 };
+		for (unsigned int i = 0; i < num_threads; ++i) {
+			m.ns_per_op += runs[i].seconds * 1e9 / iterations / num_threads;
+			m.cycles_per_op += static_cast<double>(runs[i].cycles) / iterations / num_threads;
+		}
+		m.ops_per_sec = static_cast<double>(iterations) * num_threads / wall_seconds;
+		return m;
+	}
+
+	// Find an iteration count that takes about min_seconds on one thread
+	unsigned long	calibrate (const Benchmark& bench, double min_seconds)
+	{
+		unsigned long	iterations = BATCH_SIZE;
+		for (;;) {
+			Thread_run	run = { &bench, iterations, 0, 0 };
+			thread_main(&run);
+			if (run.seconds >= min_seconds / 8) {
+				return static_cast<unsigned long>(iterations * (min_seconds / run.seconds)) + 1;
+			}
+			iterations *= 2;
+		}
+	}
+
+	bool		first_result = true;
+
+	void		run_benchmark (const Benchmark& bench, unsigned int max_threads, double min_seconds)
+	{
+		const unsigned long	iterations = calibrate(bench, min_seconds);
+
+		const char*		implementation = bench.algorithm ? tag_implementation(bench.algorithm) : bench.implementation();
+
+		// 1, 2, 4, ... threads, finishing with max_threads
+		std::vector<unsigned int>	thread_counts;
+		for (unsigned int n = 1; n < max_threads; n *= 2) {
+			thread_counts.push_back(n);
+		}
+		thread_counts.push_back(max_threads);
+
+		for (size_t i = 0; i < thread_counts.size(); ++i) {
+			const Measurement	m = measure(bench, thread_counts[i], iterations);
+
+			std::printf("%s\n  {\"benchmark\": \"%s\", \"tag_type\": \"%s\", \"implementation\": \"%s\", \"address_length\": %u, \"threads\": %u, "
+					"\"ns_per_op\": %.2f, \"cycles_per_op\": %.1f, \"ops_per_sec\": %.0f, \"bytes_per_sec\": %.0f}",
+					first_result ? "" : ",",
+					bench.name,
+					bench.algorithm ? bench.algorithm->tag_type : "",
+					implementation,
+					static_cast<unsigned int>(bench.address_length),
+					thread_counts[i],
+					m.ns_per_op,
+					m.cycles_per_op,
+					m.ops_per_sec,
+					m.ops_per_sec * bench.bytes_per_op);
+			std::fflush(stdout);
+			first_result = false;
+		}
+	}
+
+	void		setup_fixtures ()
+	{
+		unsigned char		key_bytes[32];
+		for (size_t i = 0; i < sizeof(key_bytes); ++i) {
+			key_bytes[i] = static_cast<unsigned char>(i * 37 + 11);
+		}
+		bench_key.assign(key_bytes, sizeof(key_bytes));
+
+		const std::string	domain("example.com");
+		for (size_t i = 0; i < num_address_lengths; ++i) {
+			addresses[i].local_part.assign(address_lengths[i] - domain.size() - 1, 'a');
+			addresses[i].domain = domain;
+			for (size_t t = 0; t < NUM_TAG_TYPES; ++t) {
+				batv_addresses[t][i] = tag_generate(tag_algorithms[t], addresses[i], LIFETIME, bench_key);
+			}
+		}
+	}
+
+	// Self-test (-c): hash random messages of random lengths with every
+	// implementation this CPU supports, and compare with the generic one
+	uint64_t	random_state = 0x9e3779b97f4a7c15ULL;
+
+	uint64_t	next_random ()
+	{
+		// xorshift64; the fixed seed makes failures reproducible
+		random_state ^= random_state << 13;
+		random_state ^= random_state >> 7;
+		random_state ^= random_state << 17;
+		return random_state;
+	}
+
+	void		fill_random (std::vector<unsigned char>& data, size_t len)
+	{
+		data.resize(len);
+		for (size_t i = 0; i < len; ++i) {
+			data[i] = static_cast<unsigned char>(next_random());
+		}
+	}
+
+	// Public_hash is Hash with the Scrub_never policy, which has compression functions of its own
+	template<class Hash, class Public_hash> unsigned int check_hash (const char* hash_name, const typename Hash::State_type::Implementation* implementations, size_t num_implementations, size_t num_messages)
+	{
+		typedef typename Hash::State_type	State;
+		const typename State::Implementation	default_implementation = State::get_implementation();
+		unsigned int				failures = 0;
+		std::vector<unsigned char>		data;
+
+		for (size_t j = 0; j < num_implementations; ++j) {
+			if (!State::set_implementation(implementations[j])) {
+				continue;
+			}
+			unsigned int	mismatches = 0;
+			for (size_t n = 0; n < num_messages; ++n) {
+				fill_random(data, next_random() % 1024);
+				unsigned char	expected[Hash::LENGTH];
+				unsigned char	actual[Hash::LENGTH];
+				unsigned char	actual_public[Hash::LENGTH];
+
+				State::set_implementation(State::IMPL_GENERIC);
+				Hash::compute(expected, sizeof(expected), data.empty() ? NULL : &data[0], data.size());
+				State::set_implementation(implementations[j]);
+				Hash::compute(actual, sizeof(actual), data.empty() ? NULL : &data[0], data.size());
+				Public_hash::compute(actual_public, sizeof(actual_public), data.empty() ? NULL : &data[0], data.size());
+
+				if (std::memcmp(expected, actual, Hash::LENGTH) != 0 || std::memcmp(expected, actual_public, Hash::LENGTH) != 0) {
+					if (mismatches++ == 0) {
+						std::clog << hash_name << " " << State::implementation_name(implementations[j]) << ": wrong hash of a " << data.size() << " byte message" << std::endl;
+					}
+				}
+			}
+			std::printf("%s %s: %u of %u messages wrong\n", hash_name, State::implementation_name(implementations[j]), mismatches, static_cast<unsigned int>(num_messages));
+			failures += mismatches;
+		}
+		State::set_implementation(default_implementation);
+		return failures;
+	}
+
+	unsigned int	check_sha1_multi (unsigned int lanes, size_t num_messages)
+	{
+		typedef crypto::Sha1_multi	Sha1_multi;
+		typedef crypto::Sha1_state	Sha1_state;
+
+		const unsigned int			default_lanes = Sha1_multi::lanes();
+		if (!Sha1_multi::set_lanes(lanes)) {
+			return 0;
+		}
+		const Sha1_state::Implementation	default_implementation = Sha1_state::get_implementation();
+		Sha1_state::set_implementation(Sha1_state::IMPL_GENERIC);
+
+		unsigned int				mismatches = 0;
+		unsigned int				num_checked = 0;
+		std::vector<unsigned char>		data[Sha1_multi::MAX_LANES];
+		std::vector<unsigned char>		padded[Sha1_multi::MAX_LANES];
+		Sha1_multi::Job				jobs[Sha1_multi::MAX_LANES];
+
+		for (size_t n = 0; n < num_messages; n += Sha1_multi::MAX_LANES) {
+			// Up to MAX_LANES jobs of different lengths, so lanes finish at different times
+			const size_t	num_jobs = 1 + next_random() % Sha1_multi::MAX_LANES;
+			for (size_t j = 0; j < num_jobs; ++j) {
+				fill_random(data[j], next_random() % 1024);
+				padded[j].resize(Sha1_multi::padded_length(data[j].size()));
+				Sha1_multi::init(jobs[j].state);
+				jobs[j].data = &padded[j][0];
+				jobs[j].num_blocks = Sha1_multi::pad(&padded[j][0], data[j].empty() ? NULL : &data[j][0], data[j].size());
+			}
+			Sha1_multi::compute(jobs, num_jobs);
+			for (size_t j = 0; j < num_jobs; ++j) {
+				unsigned char	expected[Sha1_multi::LENGTH];
+				unsigned char	actual[Sha1_multi::LENGTH];
+				crypto::Sha1::compute(expected, sizeof(expected), data[j].empty() ? NULL : &data[j][0], data[j].size());
+				Sha1_multi::write(jobs[j].state, actual);
+				++num_checked;
+				if (std::memcmp(expected, actual, sizeof(actual)) != 0) {
+					if (mismatches++ == 0) {
+						std::clog << "sha1_multi: wrong hash of a " << data[j].size() << " byte message" << std::endl;
+					}
+				}
+			}
+		}
+		std::printf("sha1_multi %u-lane: %u of %u messages wrong\n", Sha1_multi::lanes(), mismatches, num_checked);
+
+		Sha1_state::set_implementation(default_implementation);
+		Sha1_multi::set_lanes(default_lanes);
+		return mismatches;
+	}
+
+	void		print_usage (const char* argv0)
+	{
+		std::clog << "Usage: " << argv0 << " [OPTIONS...]" << std::endl;
+		std::clog << "Options:" << std::endl;
+		std::clog << " -T MAX_THREADS  -- run with 1, 2, 4, ... MAX_THREADS threads (default: number of CPUs)" << std::endl;
+		std::clog << " -s SECONDS      -- approximate time per measurement (default: 0.2)" << std::endl;
+		std::clog << " -b NAME         -- run only benchmarks whose name contains NAME" << std::endl;
+		std::clog << " -c              -- instead of benchmarking, check every implementation against the generic one" << std::endl;
+		std::clog << " -h              -- show this help" << std::endl;
+	}
+}
+
+int main (int argc, char** argv)
+{
+	long			num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned int		max_threads = num_cpus > 0 ? num_cpus : 1;
+	double			min_seconds = 0.2;
+	const char*		filter = NULL;
+	bool			self_test = false;
+
+	int			flag;
+	while ((flag = getopt(argc, argv, "T:s:b:ch")) != -1) {
+		switch (flag) {
+		case 'T':
+			max_threads = std::atoi(optarg);
+			break;
+		case 's':
+			min_seconds = std::atof(optarg);
+			break;
+		case 'b':
+			filter = optarg;
+			break;
+		case 'c':
+			self_test = true;
+			break;
+		case 'h':
+			print_usage(argv[0]);
+			return 0;
+		default:
+			print_usage(argv[0]);
+			return 2;
+		}
+	}
+	if (max_threads < 1 || min_seconds <= 0) {
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	setup_fixtures();
+
+	std::vector<Benchmark>	benchmarks;
+	Benchmark		bench;
+	bench.algorithm = NULL;
+	bench.address_length = 0;
+	bench.bytes_per_op = crypto::Sha1::BLOCK_LENGTH;
+	bench.name = "sha1_compress";
+	bench.run = run_sha1_compress;
+	bench.implementation = sha1_implementation;
+	benchmarks.push_back(bench);
+	bench.name = "sha256_compress";
+	bench.run = run_sha256_compress;
+	bench.implementation = sha256_implementation;
+	benchmarks.push_back(bench);
+	bench.name = "sha1_multi";
+	bench.run = run_sha1_multi;
+	bench.implementation = sha1_multi_implementation;
+	benchmarks.push_back(bench);
+	bench.bytes_per_op = 0;
+	bench.name = "hmac_key_setup";
+	bench.run = run_hmac_setup;
+	bench.implementation = sha1_implementation;
+	benchmarks.push_back(bench);
+	for (size_t i = 0; i < num_address_lengths; ++i) {
+		bench.address_length = bench.bytes_per_op = address_lengths[i];
+		for (size_t t = 0; t < NUM_TAG_TYPES; ++t) {
+			bench.algorithm = &tag_algorithms[t];
+			bench.name = "prvs_generate";
+			bench.run = run_prvs_generate;
+			benchmarks.push_back(bench);
+			bench.name = "prvs_validate";
+			bench.run = run_prvs_validate;
+			benchmarks.push_back(bench);
+		}
+		bench.algorithm = &tag_algorithms[TAG_PRVS];
+		bench.name = "prvs_validate_many";
+		bench.run = run_prvs_validate_many;
+		benchmarks.push_back(bench);
+	}
+
+	typedef crypto::Sha1_state		Sha1_state;
+	typedef crypto::Sha256_state		Sha256_state;
+	const Sha1_state::Implementation	default_sha1_implementation = Sha1_state::get_implementation();
+	const Sha1_state::Implementation	sha1_implementations[] = {
+		Sha1_state::IMPL_GENERIC,
+		Sha1_state::IMPL_SSSE3,
+		Sha1_state::IMPL_SHANI,
+		Sha1_state::IMPL_OPENSSL
+	};
+	const Sha256_state::Implementation	default_sha256_implementation = Sha256_state::get_implementation();
+	const Sha256_state::Implementation	sha256_implementations[] = {
+		Sha256_state::IMPL_GENERIC,
+		Sha256_state::IMPL_SHANI,
+		Sha256_state::IMPL_OPENSSL
+	};
+
+	if (self_test) {
+		const size_t	num_messages = 10000;
+		unsigned int	failures = 0;
+		// Random messages are public, so they're also hashed without scrubbing
+		typedef crypto::Block_hash<crypto::Basic_sha1_state<crypto::Scrub_never> >	Public_sha1;
+		typedef crypto::Block_hash<crypto::Basic_sha256_state<crypto::Scrub_never> >	Public_sha256;
+		failures += check_hash<crypto::Sha1, Public_sha1>("sha1", sha1_implementations, sizeof(sha1_implementations) / sizeof(sha1_implementations[0]), num_messages);
+		failures += check_hash<crypto::Sha256, Public_sha256>("sha256", sha256_implementations, sizeof(sha256_implementations) / sizeof(sha256_implementations[0]), num_messages);
+		// Every lane width this CPU supports, not just the one it uses
+		const unsigned int	sha1_multi_lanes[] = { 1, 4, 8, 16 };
+		for (size_t i = 0; i < sizeof(sha1_multi_lanes) / sizeof(sha1_multi_lanes[0]); ++i) {
+			failures += check_sha1_multi(sha1_multi_lanes[i], num_messages);
+		}
+		return failures ? 1 : 0;
+	}
+
+	std::printf("{\"results\": [");
+	for (size_t i = 0; i < benchmarks.size(); ++i) {
+		if (filter && !std::strstr(benchmarks[i].name, filter)) {
+			continue;
+		}
+		// Compare every compression function this CPU supports
+		if (benchmarks[i].run == run_sha1_compress) {
+			for (size_t j = 0; j < sizeof(sha1_implementations) / sizeof(sha1_implementations[0]); ++j) {
+				if (Sha1_state::set_implementation(sha1_implementations[j])) {
+					run_benchmark(benchmarks[i], max_threads, min_seconds);
+				}
+			}
+			Sha1_state::set_implementation(default_sha1_implementation);
+		} else if (benchmarks[i].run == run_sha256_compress) {
+			for (size_t j = 0; j < sizeof(sha256_implementations) / sizeof(sha256_implementations[0]); ++j) {
+				if (Sha256_state::set_implementation(sha256_implementations[j])) {
+					run_benchmark(benchmarks[i], max_threads, min_seconds);
+				}
+			}
+			Sha256_state::set_implementation(default_sha256_implementation);
+		} else {
+			run_benchmark(benchmarks[i], max_threads, min_seconds);
+		}
+	}
+	std::printf("\n]}\n");
+
+	return 0;
+}
@@ -0,0 +1,187 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+// Benchmark for Ip_prefix_set, the internal hosts matcher, against a linear
+// scan of the prefixes (what the milter used to do).  Build with
+// 'make bench-internal-hosts'.  Results are printed to stdout as JSON, one
+// object per implementation and number of prefixes.
+
+#include "ip-prefix-set.hpp"
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <time.h>
+
+using namespace batv;
+
+namespace {
+	struct Prefix {
+		struct in6_addr	address;
+		unsigned int	len;
+	};
+
+	const size_t		prefix_counts[] = { 100, 1000, 10000, 100000 };
+	const size_t		NUM_ADDRESSES = 4096;	// looked up round-robin; half are in some prefix
+
+	volatile unsigned int	sink;	// results are folded into this so they aren't optimized away
+
+	// xorshift64*, so runs are reproducible
+	uint64_t		rng_state = UINT64_C(0x9E3779B97F4A7C15);
+	uint64_t		next_random ()
+	{
+		rng_state ^= rng_state >> 12;
+		rng_state ^= rng_state << 25;
+		rng_state ^= rng_state >> 27;
+		return rng_state * UINT64_C(0x2545F4914F6CDD1D);
+	}
+
+	void			random_address (struct in6_addr* address, bool ipv4)
+	{
+		for (size_t i = 0; i < 16; i += 8) {
+			const uint64_t	r = next_random();
+			std::memcpy(address->s6_addr + i, &r, 8);
+		}
+		if (ipv4) {
+			std::memset(address->s6_addr, 0, 10);
+			address->s6_addr[10] = address->s6_addr[11] = 0xFF;
+		}
+	}
+
+	// Mostly IPv4 relay netblocks (/16 to /32), and some IPv6 ones (/32 to /64)
+	Prefix			random_prefix ()
+	{
+		Prefix		prefix;
+		const bool	ipv4 = next_random() % 5 != 0;
+		random_address(&prefix.address, ipv4);
+		prefix.len = ipv4 ? 96 + 16 + next_random() % 17 : 32 + next_random() % 33;
+		return prefix;
+	}
+
+	// The milter's old is_internal_host
+	bool			linear_contains (const std::vector<Prefix>& prefixes, const struct in6_addr& addr)
+	{
+		for (std::vector<Prefix>::const_iterator it(prefixes.begin()); it != prefixes.end(); ++it) {
+			unsigned int	prefix_bytes = it->len / 8;
+			uint8_t		last_byte_mask = 255 << (8 - it->len % 8);
+
+			if (std::memcmp(addr.s6_addr, it->address.s6_addr, prefix_bytes) == 0 &&
+				(prefix_bytes >= 16 ||
+				 ((addr.s6_addr[prefix_bytes] ^ it->address.s6_addr[prefix_bytes]) & last_byte_mask) == 0)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	double			now ()
+	{
+		struct timespec	ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return ts.tv_sec + ts.tv_nsec / 1e9;
+	}
+
+	bool			first_result = true;
+
+	void			print_result (const char* implementation, size_t num_prefixes, size_t node_count, unsigned long lookups, double seconds)
+	{
+		std::printf("%s\n  {\"benchmark\": \"is_internal_host\", \"implementation\": \"%s\", \"prefixes\": %u, \"nodes\": %u, "
+				"\"ns_per_op\": %.2f, \"ops_per_sec\": %.0f}",
+				first_result ? "" : ",",
+				implementation,
+				static_cast<unsigned int>(num_prefixes),
+				static_cast<unsigned int>(node_count),
+				seconds * 1e9 / lookups,
+				lookups / seconds);
+		std::fflush(stdout);
+		first_result = false;
+	}
+}
+
+int main (int argc, char** argv)
+{
+	const double		min_seconds = argc > 1 ? std::atof(argv[1]) : 0.5;
+
+	std::printf("{\"results\": [");
+	for (size_t c = 0; c < sizeof(prefix_counts) / sizeof(prefix_counts[0]); ++c) {
+		std::vector<Prefix>	prefixes;
+		Ip_prefix_set		set;
+		for (size_t i = 0; i < prefix_counts[c]; ++i) {
+			prefixes.push_back(random_prefix());
+			set.add(prefixes.back().address, prefixes.back().len);
+		}
+
+		// Half the addresses are inside a prefix (at a random point in it)
+		std::vector<struct in6_addr>	addresses(NUM_ADDRESSES);
+		for (size_t i = 0; i < NUM_ADDRESSES; ++i) {
+			random_address(&addresses[i], next_random() % 5 != 0);
+			if (i % 2 == 0) {
+				const Prefix&	prefix(prefixes[next_random() % prefixes.size()]);
+				for (unsigned int bit = 0; bit < prefix.len; ++bit) {
+					const unsigned char	mask = 0x80 >> (bit % 8);
+					addresses[i].s6_addr[bit / 8] = (addresses[i].s6_addr[bit / 8] & ~mask) | (prefix.address.s6_addr[bit / 8] & mask);
+				}
+			}
+		}
+
+		// Check the two agree before timing them
+		for (size_t i = 0; i < NUM_ADDRESSES; ++i) {
+			if (set.contains(addresses[i]) != linear_contains(prefixes, addresses[i])) {
+				std::fprintf(stderr, "Mismatch with %u prefixes, address %u\n", static_cast<unsigned int>(prefixes.size()), static_cast<unsigned int>(i));
+				return 1;
+			}
+		}
+
+		unsigned long	lookups = 0;
+		double		start = now();
+		double		elapsed;
+		do {
+			for (size_t i = 0; i < NUM_ADDRESSES; ++i) {
+				sink += set.contains(addresses[i]);
+			}
+			lookups += NUM_ADDRESSES;
+		} while ((elapsed = now() - start) < min_seconds);
+		print_result("trie", prefixes.size(), set.node_count(), lookups, elapsed);
+
+		lookups = 0;
+		start = now();
+		do {
+			for (size_t i = 0; i < NUM_ADDRESSES; i += 16) {
+				sink += linear_contains(prefixes, addresses[i]);
+			}
+			lookups += NUM_ADDRESSES / 16;
+		} while ((elapsed = now() - start) < min_seconds);
+		print_result("linear", prefixes.size(), 0, lookups, elapsed);
+	}
+	std::printf("\n]}\n");
+
+	return 0;
+}
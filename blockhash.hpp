@@ -36,25 +36,50 @@
 namespace crypto {
 	template<class State> class Block_hash {
 	public:
+		typedef State		State_type;
+
 		enum {
 			LENGTH = State::LENGTH,
 			BLOCK_LENGTH = State::BLOCK_LENGTH
 		};
 
 	private:
+		template<class> friend class Block_hash;
+
 		State			state;
 		unsigned long long	count;
 		unsigned char		buffer[BLOCK_LENGTH];
 
 	public:
+		typedef typename State::Scrub_policy	Scrub_policy;
+
 		Block_hash () : count(0) { }
+
+		// Convert from a hash of the same algorithm with a different zeroization policy
+		template<class Other_state> explicit Block_hash (const Block_hash<Other_state>& other)
+		: state(other.state), count(other.count)
+		{
+			std::memcpy(buffer, other.buffer, BLOCK_LENGTH);
+		}
+
 		~Block_hash ()
 		{
-			explicit_memzero(&count, sizeof(count));
-			explicit_memzero(buffer, sizeof(buffer));
+			if (Scrub_policy::on_destruction) {
+				explicit_memzero(&count, sizeof(count));
+				explicit_memzero(buffer, sizeof(buffer));
+			}
 		}
 
 		unsigned long long	get_count () const { return count; }
+		const State&		get_state () const { return state; }
+
+		// Resume from a chaining value (as from get_state().get_words()) after
+		// arg_count bytes, which must be a multiple of BLOCK_LENGTH
+		void			resume (const uint32_t* words, unsigned long long arg_count)
+		{
+			state.set_words(words);
+			count = arg_count;
+		}
 
 		void			update (const void* data, size_t len)
 		{
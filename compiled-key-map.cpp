@@ -0,0 +1,481 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "compiled-key-map.hpp"
+#include "key-map.hpp"
+#include "common.hpp"
+#include "util.hpp"
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+using namespace batv;
+
+namespace {
+	const char		MAGIC[8] = { 'B', 'A', 'T', 'V', 'K', 'M', 'A', 'P' };
+
+	enum {
+		VERSION = 2,
+		SHA1_WORDS = crypto::Sha1::State_type::STATE_WORDS,
+		SHA256_WORDS = crypto::Sha256::State_type::STATE_WORDS,
+		HEADER_LENGTH = 96,
+		SLOT_LENGTH = 16,
+		KEY_RECORD_LENGTH = 16 + 4 * (2 * SHA1_WORDS + 2 * SHA256_WORDS),
+		MAX_DISPLACEMENT = 1 << 24
+	};
+
+	// Header field offsets
+	enum {
+		H_MAGIC = 0,
+		H_VERSION = 8,
+		H_NUM_NAMES = 12,
+		H_NUM_KEYS = 16,
+		H_NUM_BUCKETS = 20,
+		H_NUM_SLOTS = 24,
+		H_WILDCARD_DEPTHS = 28,
+		H_BUCKETS_OFFSET = 32,
+		H_SLOTS_OFFSET = 40,
+		H_NAMES_OFFSET = 48,
+		H_NAMES_LENGTH = 56,
+		H_KEYS_OFFSET = 64,
+		H_KEY_DATA_OFFSET = 72,
+		H_KEY_DATA_LENGTH = 80,
+		H_FLAGS = 88
+	};
+
+	// Header flags
+	enum {
+		F_MASTER_KEYS = 0x1		// some key is a master key
+	};
+
+	// The key record's key-num word holds the key-num, plus these flags
+	enum {
+		KEY_NUM_MASK = 0xFF,
+		KEY_MASTER = 0x100
+	};
+
+	// splitmix64's finalizer, to get independent bits for the bucket and slot
+	inline uint64_t	mix (uint64_t h)
+	{
+		h ^= h >> 30;
+		h *= UINT64_C(0xBF58476D1CE4E5B9);
+		h ^= h >> 27;
+		h *= UINT64_C(0x94D049BB133111EB);
+		h ^= h >> 31;
+		return h;
+	}
+
+	inline uint32_t	bucket_index (uint64_t hash, uint32_t bucket_mask)
+	{
+		return mix(hash) & bucket_mask;
+	}
+
+	inline uint32_t	slot_index (uint64_t hash, uint32_t displacement, uint32_t slot_mask)
+	{
+		return mix(hash + (displacement + UINT64_C(1)) * UINT64_C(0x9E3779B97F4A7C15)) & slot_mask;
+	}
+
+	inline bool	is_power_of_2 (uint32_t n)
+	{
+		return n != 0 && (n & (n - 1)) == 0;
+	}
+
+	inline uint32_t	power_of_2_at_least (uint64_t n)
+	{
+		uint32_t	p = 1;
+		while (p < n) {
+			p <<= 1;
+		}
+		return p;
+	}
+
+	inline size_t	align8 (size_t n)
+	{
+		return (n + 7) & ~static_cast<size_t>(7);
+	}
+
+	// Does [offset, offset + count * size) fit in a file of len bytes?
+	inline bool	section_fits (uint64_t offset, uint64_t count, uint64_t size, uint64_t len)
+	{
+		return offset <= len && count * size <= len - offset;	// count and size are < 2^32
+	}
+
+	bool		larger_bucket (const std::vector<uint32_t>* a, const std::vector<uint32_t>* b)
+	{
+		return a->size() > b->size();
+	}
+}
+
+Compiled_key_map::Compiled_key_map (const std::string& path)
+{
+	int		fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		throw Initialization_error("Unable to open compiled key map " + path + ": " + std::strerror(errno));
+	}
+	struct stat	status;
+	if (fstat(fd, &status) == -1) {
+		close(fd);
+		throw Initialization_error("Unable to stat compiled key map " + path + ": " + std::strerror(errno));
+	}
+	if (status.st_size < HEADER_LENGTH) {
+		close(fd);
+		throw Initialization_error("Compiled key map " + path + " is truncated");
+	}
+	data_len = status.st_size;
+	void*		map = mmap(NULL, data_len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		throw Initialization_error("Unable to mmap compiled key map " + path + ": " + std::strerror(errno));
+	}
+	data = static_cast<const unsigned char*>(map);
+
+	const uint32_t	version = load_be32(data + H_VERSION);
+	const uint32_t	num_buckets = load_be32(data + H_NUM_BUCKETS);
+	const uint32_t	num_slots = load_be32(data + H_NUM_SLOTS);
+	const uint64_t	buckets_offset = load_be64(data + H_BUCKETS_OFFSET);
+	const uint64_t	slots_offset = load_be64(data + H_SLOTS_OFFSET);
+	const uint64_t	names_offset = load_be64(data + H_NAMES_OFFSET);
+	const uint64_t	names_length = load_be64(data + H_NAMES_LENGTH);
+	const uint64_t	keys_offset = load_be64(data + H_KEYS_OFFSET);
+	const uint64_t	key_data_offset = load_be64(data + H_KEY_DATA_OFFSET);
+	const uint64_t	key_data_length = load_be64(data + H_KEY_DATA_LENGTH);
+	num_keys = load_be32(data + H_NUM_KEYS);
+	wildcard_depths = load_be32(data + H_WILDCARD_DEPTHS);
+	any_master_keys = load_be32(data + H_FLAGS) & F_MASTER_KEYS;
+
+	const char*	error = NULL;
+	if (std::memcmp(data + H_MAGIC, MAGIC, sizeof(MAGIC)) != 0) {
+		error = " is not a compiled key map";
+	} else if (version != VERSION) {
+		error = " has an unsupported version (recompile it with this version of batv-keymap-compile)";
+	} else if (!is_power_of_2(num_buckets) || !is_power_of_2(num_slots) ||
+			!section_fits(buckets_offset, num_buckets, 4, data_len) ||
+			!section_fits(slots_offset, num_slots, SLOT_LENGTH, data_len) ||
+			!section_fits(names_offset, names_length, 1, data_len) ||
+			(names_length > 0 && data[names_offset + names_length - 1] != '\0') ||
+			!section_fits(keys_offset, num_keys, KEY_RECORD_LENGTH, data_len) ||
+			!section_fits(key_data_offset, key_data_length, 1, data_len)) {
+		error = " is corrupt";
+	}
+	if (error) {
+		munmap(map, data_len);
+		throw Initialization_error("Compiled key map " + path + error);
+	}
+
+	bucket_mask = num_buckets - 1;
+	slot_mask = num_slots - 1;
+	buckets = data + buckets_offset;
+	slots = data + slots_offset;
+	names = reinterpret_cast<const char*>(data + names_offset);
+	names_len = names_length;
+	key_records = data + keys_offset;
+	key_data = data + key_data_offset;
+	key_data_len = key_data_length;
+
+	// calloc of a large array gets fresh zero pages, so this doesn't touch num_keys pointers
+	keys = static_cast<Key**>(std::calloc(num_keys ? num_keys : 1, sizeof(Key*)));
+	if (!keys) {
+		munmap(map, data_len);
+		throw Initialization_error("Out of memory opening compiled key map " + path);
+	}
+}
+
+Compiled_key_map::~Compiled_key_map ()
+{
+	for (uint32_t i = 0; i < num_keys; ++i) {
+		delete keys[i];
+	}
+	std::free(keys);
+	munmap(const_cast<unsigned char*>(data), data_len);
+}
+
+bool	Compiled_key_map::find (uint64_t hash, const char** name, uint32_t* key_index) const
+{
+	const uint32_t		displacement = load_be32(buckets + 4 * bucket_index(hash, bucket_mask));
+	const unsigned char*	slot = slots + SLOT_LENGTH * static_cast<size_t>(slot_index(hash, displacement, slot_mask));
+	const uint32_t		name_offset = load_be32(slot + 8);
+	const uint32_t		key_index_plus_one = load_be32(slot + 12);
+
+	if (key_index_plus_one == 0 || load_be64(slot) != hash || name_offset >= names_len) {
+		return false;
+	}
+	*name = names + name_offset;	// NUL-terminated, since the names section ends with a NUL
+	*key_index = key_index_plus_one - 1;
+	return true;
+}
+
+const Key*	Compiled_key_map::get_key (uint32_t key_index) const
+{
+	if (key_index >= num_keys) {
+		return NULL;
+	}
+
+	Key*			key = __atomic_load_n(&keys[key_index], __ATOMIC_ACQUIRE);
+	if (key) {
+		return key;
+	}
+
+	const unsigned char*	record = key_records + static_cast<size_t>(key_index) * KEY_RECORD_LENGTH;
+	const uint64_t		offset = load_be64(record);
+	const uint32_t		len = load_be32(record + 8);
+	const uint32_t		num = load_be32(record + 12);
+	if (offset > key_data_len || len > key_data_len - offset ||
+			(num & ~(KEY_NUM_MASK | KEY_MASTER)) || (num & KEY_NUM_MASK) > Key::MAX_NUM) {
+		return NULL;
+	}
+
+	uint32_t		sha1_midstates[2 * SHA1_WORDS];
+	uint32_t		sha256_midstates[2 * SHA256_WORDS];
+	for (size_t i = 0; i < 2 * SHA1_WORDS; ++i) {
+		sha1_midstates[i] = load_be32(record + 16 + 4 * i);
+	}
+	for (size_t i = 0; i < 2 * SHA256_WORDS; ++i) {
+		sha256_midstates[i] = load_be32(record + 16 + 4 * (2 * SHA1_WORDS + i));
+	}
+
+	Key*			new_key = new Key;
+	new_key->assign(key_data + offset, len, sha1_midstates, sha256_midstates);
+	new_key->set_num(num & KEY_NUM_MASK);
+	new_key->set_master(num & KEY_MASTER);
+	explicit_memzero(sha1_midstates, sizeof(sha1_midstates));
+	explicit_memzero(sha256_midstates, sizeof(sha256_midstates));
+
+	// Another thread may have beaten us to it, in which case use its key
+	if (!__atomic_compare_exchange_n(&keys[key_index], &key, new_key, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		delete new_key;
+		return key;
+	}
+	return new_key;
+}
+
+bool	Compiled_key_map::is_compiled (const std::string& path)
+{
+	int		fd = open(path.c_str(), O_RDONLY);
+	if (fd == -1) {
+		return false;
+	}
+	char		magic[sizeof(MAGIC)];
+	const bool	result = read(fd, magic, sizeof(magic)) == static_cast<ssize_t>(sizeof(magic)) && std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+	close(fd);
+	return result;
+}
+
+void	batv::compile_key_map (const Key_map& key_map, const std::string& path)
+{
+	const size_t			num_names = key_map.size();
+	if (key_map.is_lazy()) {
+		throw Initialization_error("A lazy key map can't be compiled");
+	}
+	if (num_names > 0x7FFFFFFF) {
+		throw Initialization_error("Key map has too many entries to compile");
+	}
+
+	// The key map has already interned its keys, so identical keys share a key
+	// record.  Only write the keys that some name still refers to.
+	std::vector<uint32_t>		key_records(key_map.num_keys(), 0);	// index of each interned key's record, plus one
+	std::vector<uint32_t>		name_keys(num_names);	// index of each name's key record
+	std::vector<const Key*>		keys;
+	bool				has_master_keys = false;
+	for (size_t i = 0; i < num_names; ++i) {
+		const uint32_t		k = key_map.key_index_at(i);
+		if (!key_records[k]) {
+			keys.push_back(&key_map.interned_key(k));
+			has_master_keys |= keys.back()->is_master();
+			key_records[k] = keys.size();
+		}
+		name_keys[i] = key_records[k] - 1;
+	}
+
+	// Build the perfect hash ("hash and displace"): place the largest buckets
+	// first, finding for each a displacement that puts all its names in free slots
+	const uint32_t			num_buckets = power_of_2_at_least(num_names / 4 + 1);
+	const uint32_t			num_slots = power_of_2_at_least(num_names + num_names / 4 + 1);
+	std::vector<uint64_t>		hashes(num_names);
+	std::vector<std::vector<uint32_t> > bucket_names(num_buckets);
+	for (size_t i = 0; i < num_names; ++i) {
+		hashes[i] = hash_key_map_name(String_view(key_map.name_at(i)));
+		bucket_names[bucket_index(hashes[i], num_buckets - 1)].push_back(i);
+	}
+
+	std::vector<const std::vector<uint32_t>*> order(num_buckets);
+	for (uint32_t b = 0; b < num_buckets; ++b) {
+		order[b] = &bucket_names[b];
+	}
+	std::stable_sort(order.begin(), order.end(), larger_bucket);
+
+	std::vector<uint32_t>		displacements(num_buckets, 0);
+	std::vector<uint32_t>		slot_names(num_slots, 0);	// index of the name in each slot, plus one
+	std::vector<uint32_t>		candidate_slots;
+	for (uint32_t o = 0; o < num_buckets && !order[o]->empty(); ++o) {
+		const std::vector<uint32_t>&	members(*order[o]);
+		uint32_t			displacement = 0;
+		for (; displacement < MAX_DISPLACEMENT; ++displacement) {
+			candidate_slots.clear();
+			for (size_t m = 0; m < members.size(); ++m) {
+				const uint32_t	s = slot_index(hashes[members[m]], displacement, num_slots - 1);
+				if (slot_names[s] || std::find(candidate_slots.begin(), candidate_slots.end(), s) != candidate_slots.end()) {
+					break;
+				}
+				candidate_slots.push_back(s);
+			}
+			if (candidate_slots.size() == members.size()) {
+				break;
+			}
+		}
+		if (displacement == MAX_DISPLACEMENT) {
+			throw Initialization_error("Unable to build the key map index (are there two names with the same hash?)");
+		}
+		displacements[bucket_index(hashes[members[0]], num_buckets - 1)] = displacement;
+		for (size_t m = 0; m < members.size(); ++m) {
+			slot_names[candidate_slots[m]] = members[m] + 1;
+		}
+	}
+
+	// Lay out the file
+	const size_t			buckets_offset = HEADER_LENGTH;
+	const size_t			slots_offset = align8(buckets_offset + 4 * static_cast<size_t>(num_buckets));
+	const size_t			names_offset = slots_offset + SLOT_LENGTH * static_cast<size_t>(num_slots);
+	std::vector<uint32_t>		name_offsets(num_names);
+	size_t				names_length = 0;
+	for (size_t i = 0; i < num_names; ++i) {
+		name_offsets[i] = names_length;
+		names_length += std::strlen(key_map.name_at(i)) + 1;
+	}
+	const size_t			keys_offset = align8(names_offset + names_length);
+	const size_t			key_data_offset = keys_offset + KEY_RECORD_LENGTH * keys.size();
+	size_t				key_data_length = 0;
+	for (size_t k = 0; k < keys.size(); ++k) {
+		key_data_length += keys[k]->get_bytes().size();
+	}
+	if (names_length > 0xFFFFFFFF || key_data_offset + key_data_length < key_data_offset) {
+		throw Initialization_error("Key map is too large to compile");
+	}
+
+	std::vector<unsigned char>	out(key_data_offset + key_data_length, 0);
+	unsigned char*			p = &out[0];
+
+	std::memcpy(p + H_MAGIC, MAGIC, sizeof(MAGIC));
+	store_be32(p + H_VERSION, VERSION);
+	store_be32(p + H_NUM_NAMES, num_names);
+	store_be32(p + H_NUM_KEYS, keys.size());
+	store_be32(p + H_NUM_BUCKETS, num_buckets);
+	store_be32(p + H_NUM_SLOTS, num_slots);
+	store_be32(p + H_WILDCARD_DEPTHS, key_map.get_wildcard_depths());
+	store_be32(p + H_FLAGS, has_master_keys ? F_MASTER_KEYS : 0);
+	store_be64(p + H_BUCKETS_OFFSET, buckets_offset);
+	store_be64(p + H_SLOTS_OFFSET, slots_offset);
+	store_be64(p + H_NAMES_OFFSET, names_offset);
+	store_be64(p + H_NAMES_LENGTH, names_length);
+	store_be64(p + H_KEYS_OFFSET, keys_offset);
+	store_be64(p + H_KEY_DATA_OFFSET, key_data_offset);
+	store_be64(p + H_KEY_DATA_LENGTH, key_data_length);
+
+	for (uint32_t b = 0; b < num_buckets; ++b) {
+		store_be32(p + buckets_offset + 4 * b, displacements[b]);
+	}
+	for (uint32_t s = 0; s < num_slots; ++s) {
+		if (const uint32_t name_plus_one = slot_names[s]) {
+			unsigned char*	slot = p + slots_offset + SLOT_LENGTH * static_cast<size_t>(s);
+			store_be64(slot, hashes[name_plus_one - 1]);
+			store_be32(slot + 8, name_offsets[name_plus_one - 1]);
+			store_be32(slot + 12, name_keys[name_plus_one - 1] + 1);
+		}
+	}
+	for (size_t i = 0; i < num_names; ++i) {
+		std::strcpy(reinterpret_cast<char*>(p + names_offset + name_offsets[i]), key_map.name_at(i));
+	}
+	size_t				key_data_pos = 0;
+	for (size_t k = 0; k < keys.size(); ++k) {
+		const Key&		key(*keys[k]);
+		unsigned char*		record = p + keys_offset + KEY_RECORD_LENGTH * k;
+		const uint32_t*		midstates[4] = {
+			key.get_hmac_key().get_inner().get_state().get_words(),
+			key.get_hmac_key().get_outer().get_state().get_words(),
+			key.get_hmac_sha256_key().get_inner().get_state().get_words(),
+			key.get_hmac_sha256_key().get_outer().get_state().get_words()
+		};
+		const size_t		midstate_words[4] = { SHA1_WORDS, SHA1_WORDS, SHA256_WORDS, SHA256_WORDS };
+
+		store_be64(record, key_data_pos);
+		store_be32(record + 8, key.get_bytes().size());
+		store_be32(record + 12, key.get_num() | (key.is_master() ? KEY_MASTER : 0));
+		unsigned char*		q = record + 16;
+		for (size_t m = 0; m < 4; ++m) {
+			for (size_t w = 0; w < midstate_words[m]; ++w, q += 4) {
+				store_be32(q, midstates[m][w]);
+			}
+		}
+		if (!key.get_bytes().empty()) {
+			std::memcpy(p + key_data_offset + key_data_pos, &key.get_bytes()[0], key.get_bytes().size());
+			key_data_pos += key.get_bytes().size();
+		}
+	}
+
+	// Write to a temporary file (readable only by us, since it holds keys) and
+	// rename it into place, so processes that have the old file mapped keep it
+	std::vector<char>		temp_path(path.begin(), path.end());
+	const char			temp_suffix[] = ".XXXXXX";
+	temp_path.insert(temp_path.end(), temp_suffix, temp_suffix + sizeof(temp_suffix));
+	int				fd = mkstemp(&temp_path[0]);
+	if (fd == -1) {
+		explicit_memzero(&out[0], out.size());
+		throw Initialization_error("Unable to create temporary file for " + path + ": " + std::strerror(errno));
+	}
+	size_t				written = 0;
+	while (written < out.size()) {
+		ssize_t			n = write(fd, &out[written], out.size() - written);
+		if (n == -1 && errno == EINTR) {
+			continue;
+		}
+		if (n == -1) {
+			break;
+		}
+		written += n;
+	}
+	const int			write_errno = errno;
+	explicit_memzero(&out[0], out.size());
+	if (written < out.size() || fsync(fd) == -1 || close(fd) == -1) {
+		std::remove(&temp_path[0]);
+		throw Initialization_error("Unable to write " + path + ": " + std::strerror(written < out.size() ? write_errno : errno));
+	}
+	if (std::rename(&temp_path[0], path.c_str()) == -1) {
+		const int		rename_errno = errno;
+		std::remove(&temp_path[0]);
+		throw Initialization_error("Unable to rename temporary file to " + path + ": " + std::strerror(rename_errno));
+	}
+}
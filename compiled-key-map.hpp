@@ -0,0 +1,98 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef BATV_COMPILED_KEY_MAP_HPP
+#define BATV_COMPILED_KEY_MAP_HPP
+
+#include "key.hpp"
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace batv {
+	class Key_map;
+
+	// A key map compiled by batv-keymap-compile: an immutable file holding a
+	// perfect hash index of the names, plus the keys with their HMAC
+	// midstates.  The file is mmapped, so opening it is O(1) regardless of
+	// size and its pages are shared by every process using it.  A Key object
+	// is only built the first time its key is looked up.
+	//
+	// File format (integers are big endian, sections are 8-byte aligned):
+	//  header:	"BATVKMAP", version, num_names, num_keys, num_buckets, num_slots,
+	//		wildcard depths (see Key_map), the offsets of the sections below, flags
+	//  buckets:	num_buckets 32-bit displacements
+	//  slots:	num_slots slots of { 64-bit name hash, name offset, key index + 1 (0 if empty) }
+	//  names:	NUL-terminated names, with lowercased domains
+	//  keys:	num_keys records of { key data offset, key length, key-num (plus 0x100 for a master key),
+	//		HMAC-SHA-1 inner and outer midstates, HMAC-SHA-256 inner and outer midstates }
+	//  key data:	the key bytes
+	// A name with hash h is in slot slot_index(h, buckets[bucket_index(h)]), if anywhere.
+	class Compiled_key_map {
+		const unsigned char*	data;
+		size_t			data_len;
+		uint32_t		num_keys;
+		uint32_t		wildcard_depths;
+		bool			any_master_keys;
+		uint32_t		bucket_mask;
+		uint32_t		slot_mask;
+		const unsigned char*	buckets;
+		const unsigned char*	slots;
+		const char*		names;
+		size_t			names_len;
+		const unsigned char*	key_records;
+		const unsigned char*	key_data;
+		size_t			key_data_len;
+		Key**			keys;		// built on first use
+
+		Compiled_key_map (const Compiled_key_map&);		// not copyable
+		Compiled_key_map& operator= (const Compiled_key_map&);
+	public:
+		explicit Compiled_key_map (const std::string& path);	// throws Initialization_error
+		~Compiled_key_map ();
+
+		// If a name with the given hash (see hash_key_map_name) might be in the
+		// map, set *name to it and return true.  The caller compares the name.
+		bool			find (uint64_t hash, const char** name, uint32_t* key_index) const;
+
+		// NULL if the key record is malformed.  Safe to call from multiple threads.
+		const Key*		get_key (uint32_t key_index) const;
+
+		uint32_t		get_wildcard_depths () const { return wildcard_depths; }
+		bool			has_master_keys () const { return any_master_keys; }
+
+		static bool		is_compiled (const std::string& path);	// does the file start with the magic number?
+	};
+
+	// Compile key_map into a file at path (replaced atomically).  Throws Initialization_error.
+	void		compile_key_map (const Key_map& key_map, const std::string& path);
+}
+
+#endif
@@ -107,20 +107,7 @@ bool Config::is_internal_host (const struct in_addr& addr) const
 
 bool Config::is_internal_host (const struct in6_addr& addr) const
 {
-	std::vector<Ipv6_cidr>::const_iterator it(internal_hosts.begin());
-	while (it != internal_hosts.end()) {
-		unsigned int	prefix_bytes = it->second / 8;
-		uint8_t		last_byte_mask = 255 << (8 - it->second % 8);
-
-		if (std::memcmp(addr.s6_addr, it->first.s6_addr, prefix_bytes) == 0 &&
-			(prefix_bytes >= 16 ||
-			 ((addr.s6_addr[prefix_bytes] ^ it->first.s6_addr[prefix_bytes]) & last_byte_mask) == 0)) {
-			return true;
-		}
-
-		++it;
-	}
-	return false;
+	return internal_hosts.contains(addr);
 }
 
 void	Config::set (const std::string& directive, const std::string& value)
@@ -177,18 +164,34 @@ void	Config::set (const std::string& directive, const std::string& value)
 			throw Initialization_error("Invalid address lifetime " + value + " (must be between 1 and 999, inclusive)");
 		}
 	} else if (directive == "internal-host") {
-		internal_hosts.push_back(parse_cidr_string(value.c_str()));
+		const Ipv6_cidr		cidr(parse_cidr_string(value.c_str()));
+		internal_hosts.add(cidr.first, cidr.second);
+	} else if (directive == "internal-hosts-file") {
+		std::ifstream	hosts_in(value.c_str());
+		if (!hosts_in) {
+			throw Initialization_error("Unable to open internal hosts file " + value);
+		}
+		load_internal_hosts(hosts_in);
 	} else if (directive == "sub-address-delimiter") {
 		if (value.size() != 1) {
 			throw Initialization_error("Sub address delimiter must be exactly one character");
 		}
 		sub_address_delimiter = value[0];
-	} else if (directive == "key-map") {
-		std::ifstream	key_map_in(value.c_str());
-		if (!key_map_in) {
-			throw Initialization_error("Unable to open key map " + value);
+	} else if (directive == "tag-type") {
+		if (!(tag_algorithm = find_tag_algorithm(value))) {
+			throw Initialization_error("Invalid value for 'tag-type' directive (should be 'prvs' or 'prvs-sha256'): " + value);
+		}
+	} else if (directive == "key-cache-size") {
+		if (!keys.empty()) {
+			throw Initialization_error("key-cache-size must come before key-map");
 		}
-		load_key_map(keys, key_map_in);
+		const int	cache_size = std::atoi(value.c_str());
+		if (cache_size < 1) {
+			throw Initialization_error("Invalid key cache size " + value + " (must be at least 1)");
+		}
+		keys.set_lazy(cache_size);
+	} else if (directive == "key-map") {
+		load_key_map_file(keys, value);
 	} else if (directive == "on-invalid") {
 		if (value == "tempfail") {
 			on_invalid = FAILURE_TEMPFAIL;
@@ -213,6 +216,16 @@ void	Config::set (const std::string& directive, const std::string& value)
 		} else {
 			throw Initialization_error("Invalid value for 'on-internal-error' directive (should be 'tempfail', 'accept', 'reject', or 'discard'): " + value);
 		}
+	} else if (directive == "stats-socket") {
+		stats_socket = value;
+	} else if (directive == "stats-file") {
+		stats_file = value;
+	} else if (directive == "stats-interval") {
+		const int	interval = std::atoi(value.c_str());
+		if (interval < 1 || interval > 86400) {
+			throw Initialization_error("Invalid stats interval " + value + " (must be between 1 and 86400 seconds, inclusive)");
+		}
+		stats_interval = interval;
 	} else {
 		throw Initialization_error("Invalid config directive " + directive);
 	}
@@ -243,10 +256,29 @@ void	Config::load (std::istream& in)
 	}
 }
 
+void	Config::load_internal_hosts (std::istream& in)
+{
+	std::string		line;
+	while (std::getline(in, line)) {
+		// Skip comments and blank lines; allow leading whitespace
+		const std::string::size_type	start = line.find_first_not_of(" \t");
+		if (start == std::string::npos || line[start] == '#') {
+			continue;
+		}
+		chomp(line);
+
+		const Ipv6_cidr		cidr(parse_cidr_string(line.c_str() + start));
+		internal_hosts.add(cidr.first, cidr.second);
+	}
+}
+
 void	Config::validate () const
 {
 	if (socket_spec.empty()) {
 		throw Initialization_error("Milter socket not specified");
 	}
+	if (!tag_type_usable_with_delimiter(*tag_algorithm, sub_address_delimiter)) {
+		throw Initialization_error(std::string("Tag type '") + tag_algorithm->tag_type + "' cannot be used with sub-address delimiter '" + sub_address_delimiter + "' because it contains the delimiter");
+	}
 }
 
@@ -33,6 +33,7 @@
 
 #include "key.hpp"
 #include "config.hpp"
+#include "ip-prefix-set.hpp"
 #include <utility>
 #include <netinet/in.h>
 #include <map>
@@ -60,15 +61,19 @@ namespace batv {
 		int			socket_mode;		// or -1 to use the umask
 		bool			do_sign;
 		bool			do_verify;
-		std::vector<Ipv6_cidr>	internal_hosts;		// we generate BATV addresses only for mail from these hosts
+		Ip_prefix_set		internal_hosts;		// we generate BATV addresses only for mail from these hosts
 		Failure_mode		on_invalid;		// what to do about an invalid/missing BATV signature
 		Failure_mode		on_internal_error;	// what to do when an internal error happens
+		std::string		stats_socket;		// UNIX domain socket to serve metrics on, if not empty
+		std::string		stats_file;		// file to write metrics to, if not empty...
+		unsigned int		stats_interval;		// ...every this many seconds
 
 		bool			is_internal_host (const struct in6_addr&) const;	// Is given IPv6 address internal?
 		bool			is_internal_host (const struct in_addr&) const;		// Is given IPv4 addres internal?
 
 		void			set (const std::string& directive, const std::string& value);
 		void			load (std::istream&);
+		void			load_internal_hosts (std::istream&);	// one address or subnet per line
 		void			validate () const;
 
 		Config ()
@@ -80,6 +85,7 @@ namespace batv {
 			do_verify = true;
 			on_invalid = FAILURE_ACCEPT;
 			on_internal_error = FAILURE_TEMPFAIL;
+			stats_interval = 15;
 		}
 
 	};
@@ -33,8 +33,13 @@
 
 using namespace batv;
 
-const Key* Common_config::get_key (const std::string& sender_address) const
+const Key* Common_config::get_key (const std::string& sender_address, Key* lazy_key, int key_num) const
 {
-	return batv::get_key(keys, sender_address, !default_key.empty() ? &default_key : NULL);
+	return batv::get_key(keys, sender_address, !default_key.empty() ? &default_key : NULL, lazy_key, key_num);
+}
+
+const Key* Common_config::get_key (const Email_address_view& sender_address, Key* lazy_key, int key_num) const
+{
+	return batv::get_key(keys, sender_address, !default_key.empty() ? &default_key : NULL, lazy_key, key_num);
 }
 
@@ -31,7 +31,8 @@
 #ifndef BATV_CONFIG_HPP
 #define BATV_CONFIG_HPP
 
-#include "key.hpp"
+#include "key-map.hpp"
+#include "tag.hpp"
 #include <vector>
 #include <string>
 
@@ -41,15 +42,20 @@ namespace batv {
 		Key			default_key;		// key to use if address/domain not in key map
 		unsigned int		address_lifetime;	// in days, how long BATV address is valid
 		char			sub_address_delimiter;	// e.g. "+"
+		const Tag_algorithm*	tag_algorithm;		// used to sign addresses (all known algorithms are verified)
 
 		Common_config ()
 		{
 			address_lifetime = 7;
 			sub_address_delimiter = 0;
+			tag_algorithm = &tag_algorithms[TAG_PRVS];
 		}
 
-		const Key*		get_key (const std::string& sender_address) const;	// Get HMAC key for the given sender
-												// (NULL if sender doesn't use BATV)
+		// Get HMAC key for the given sender (NULL if sender doesn't use BATV).
+		// If keys is lazy, the key may be copied into *lazy_key; key_num picks
+		// one of the sender's keys (see Key_map::find).
+		const Key*		get_key (const std::string& sender_address, Key* lazy_key =NULL, int key_num =Key_map::CURRENT_KEY) const;
+		const Key*		get_key (const Email_address_view& sender_address, Key* lazy_key =NULL, int key_num =Key_map::CURRENT_KEY) const;
 	};
 }
 
@@ -30,42 +30,103 @@
 
 #include <cstring>
 #include <stddef.h>
+#include <stdint.h>
 #include "util.hpp"
 
 namespace crypto {
-	template<class Hash> class Hmac {
-		Hash		hash;
-		unsigned char	key[Hash::BLOCK_LENGTH];
-		size_t		key_len;
+	// The HMAC key schedule: hash states that have already absorbed the
+	// inner (key ^ ipad) and outer (key ^ opad) key blocks.  Computing
+	// these costs two compressions, so it is worth doing once per key
+	// rather than once per message.  Since the key blocks are raw key
+	// material, Hash should scrub on every transform (as crypto::Sha1 does).
+	template<class Hash> class Hmac_key {
+		Hash		inner;
+		Hash		outer;
 	public:
 		enum {
-			LENGTH = Hash::LENGTH,
 			KEY_LENGTH = Hash::BLOCK_LENGTH
 		};
 
-		Hmac (const unsigned char* arg_key, size_t arg_key_len =KEY_LENGTH)
+		Hmac_key ()
+		{
+			set(NULL, 0);
+		}
+		Hmac_key (const unsigned char* arg_key, size_t arg_key_len =KEY_LENGTH)
 		{
+			set(arg_key, arg_key_len);
+		}
+
+		void		set (const unsigned char* arg_key, size_t arg_key_len)
+		{
+			unsigned char	key[Hash::BLOCK_LENGTH];
+			size_t		key_len;
+
 			if (arg_key_len > Hash::BLOCK_LENGTH) {
 				Hash::compute(key, Hash::BLOCK_LENGTH, arg_key, arg_key_len);
 				key_len = Hash::LENGTH;
 			} else {
-				std::memcpy(key, arg_key, arg_key_len);
+				if (arg_key_len > 0) {
+					std::memcpy(key, arg_key, arg_key_len);
+				}
 				key_len = arg_key_len;
 			}
 
-			unsigned char	k_ipad[Hash::BLOCK_LENGTH];
-			std::memset(k_ipad, 0, Hash::BLOCK_LENGTH);
-			std::memcpy(k_ipad, key, key_len);
+			unsigned char	k_pad[Hash::BLOCK_LENGTH];
+
+			std::memset(k_pad, 0, Hash::BLOCK_LENGTH);
+			std::memcpy(k_pad, key, key_len);
+			for (size_t i = 0; i < Hash::BLOCK_LENGTH; ++i) {
+				k_pad[i] ^= 0x36;
+			}
+			inner = Hash();
+			inner.update(k_pad, Hash::BLOCK_LENGTH);
+
+			std::memset(k_pad, 0, Hash::BLOCK_LENGTH);
+			std::memcpy(k_pad, key, key_len);
 			for (size_t i = 0; i < Hash::BLOCK_LENGTH; ++i) {
-				k_ipad[i] ^= 0x36;
+				k_pad[i] ^= 0x5c;
 			}
+			outer = Hash();
+			outer.update(k_pad, Hash::BLOCK_LENGTH);
 
-			hash.update(k_ipad, Hash::BLOCK_LENGTH);
-			explicit_memzero(k_ipad, Hash::BLOCK_LENGTH);
+			explicit_memzero(k_pad, Hash::BLOCK_LENGTH);
+			explicit_memzero(key, Hash::BLOCK_LENGTH);
 		}
-		~Hmac ()
+
+		// Set the key schedule from midstates saved from get_inner() and
+		// get_outer() (STATE_WORDS each), without having the key
+		void		set_midstates (const uint32_t* inner_words, const uint32_t* outer_words)
+		{
+			inner.resume(inner_words, Hash::BLOCK_LENGTH);
+			outer.resume(outer_words, Hash::BLOCK_LENGTH);
+		}
+
+		const Hash&	get_inner () const { return inner; }
+		const Hash&	get_outer () const { return outer; }
+	};
+
+	template<class Hash> class Hmac {
+		Hash		hash;
+		Hash		outer_hash;
+	public:
+		enum {
+			LENGTH = Hash::LENGTH,
+			KEY_LENGTH = Hash::BLOCK_LENGTH,
+			MAX_SHORT_LENGTH = Hash::BLOCK_LENGTH - 9	// longest message that fits in one block with padding
+		};
+
+		Hmac (const unsigned char* arg_key, size_t arg_key_len =KEY_LENGTH)
+		{
+			Hmac_key<Hash>	key(arg_key, arg_key_len);
+			hash = key.get_inner();
+			outer_hash = key.get_outer();
+		}
+		// The key's hash may have a different zeroization policy from Hash:
+		// typically the key is prepared with a hash that scrubs everything,
+		// while messages are hashed with a cheaper policy.
+		template<class Key_hash> explicit Hmac (const Hmac_key<Key_hash>& key)
+		: hash(key.get_inner()), outer_hash(key.get_outer())
 		{
-			explicit_memzero(key, Hash::BLOCK_LENGTH);
 		}
 
 		inline void	update (const void* data, size_t len)
@@ -78,19 +139,12 @@ namespace crypto {
 			unsigned char	digest[Hash::LENGTH];
 			hash.finish(digest);
 
-			unsigned char	k_opad[Hash::BLOCK_LENGTH];
-			std::memset(k_opad, 0, Hash::BLOCK_LENGTH);
-			std::memcpy(k_opad, key, key_len);
-			for (size_t i = 0; i < Hash::BLOCK_LENGTH; ++i) {
-				k_opad[i] ^= 0x5c;
-			}
-
-			Hash		final_hash;
-			final_hash.update(k_opad, Hash::BLOCK_LENGTH);
-			final_hash.update(digest, Hash::LENGTH);
-			final_hash.finish(out, out_len);
+			outer_hash.update(digest, Hash::LENGTH);
+			outer_hash.finish(out, out_len);
 
-			explicit_memzero(k_opad, Hash::BLOCK_LENGTH);
+			if (Hash::Scrub_policy::on_destruction) {
+				explicit_memzero(digest, Hash::LENGTH);
+			}
 		}
 
 		static void compute (unsigned char* out, size_t out_len, const unsigned char* key, size_t key_len, const void* data, size_t data_len)
@@ -99,6 +153,38 @@ namespace crypto {
 			hmac.update(data, data_len);
 			hmac.finish(out, out_len);
 		}
+
+		template<class Key_hash> static void compute (unsigned char* out, size_t out_len, const Hmac_key<Key_hash>& key, const void* data, size_t data_len)
+		{
+			Hmac		hmac(key);
+			hmac.update(data, data_len);
+			hmac.finish(out, out_len);
+		}
+
+		// Fast path for messages of at most MAX_SHORT_LENGTH bytes, which are
+		// passed in the first len bytes of block (BLOCK_LENGTH bytes long, and
+		// clobbered).  The inner and outer hashes are each exactly one
+		// compression of a block padded in place, with no buffering, and only
+		// the first OUT_LENGTH bytes of the HMAC are produced.
+		template<size_t OUT_LENGTH, class Key_hash> static void compute_short (unsigned char* out, const Hmac_key<Key_hash>& key, unsigned char* block, size_t len)
+		{
+			typedef typename Hash::State_type	State;
+
+			State		inner_state(key.get_inner().get_state());
+			State::pad_block(block, len, key.get_inner().get_count() + len);
+			inner_state.transform(block);
+
+			// The inner digest is written straight into the outer block
+			State		outer_state(key.get_outer().get_state());
+			inner_state.write(block, Hash::LENGTH);
+			State::pad_block(block, Hash::LENGTH, key.get_outer().get_count() + Hash::LENGTH);
+			outer_state.transform(block);
+			outer_state.write(out, OUT_LENGTH);
+
+			if (Hash::Scrub_policy::on_destruction) {
+				explicit_memzero(block, Hash::BLOCK_LENGTH);
+			}
+		}
 	};
 }
 
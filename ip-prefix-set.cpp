@@ -0,0 +1,178 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "ip-prefix-set.hpp"
+#include "util.hpp"
+
+using namespace batv;
+
+namespace {
+	inline void		load_address (uint64_t* bits, const struct in6_addr& address)
+	{
+		bits[0] = load_be64(address.s6_addr);
+		bits[1] = load_be64(address.s6_addr + 8);
+	}
+
+	// Zero the bits after the first len
+	inline void		truncate (uint64_t* bits, unsigned int len)
+	{
+		if (len < 64) {
+			bits[0] = len ? bits[0] & (~UINT64_C(0) << (64 - len)) : 0;
+			bits[1] = 0;
+		} else if (len < 128) {
+			bits[1] = len > 64 ? bits[1] & (~UINT64_C(0) << (128 - len)) : 0;
+		}
+	}
+
+	inline unsigned int	bit_at (const uint64_t* bits, unsigned int i)
+	{
+		return (bits[i / 64] >> (63 - i % 64)) & 1;
+	}
+
+	// The number of leading bits that a and b have in common
+	inline unsigned int	common_prefix_len (const uint64_t* a, const uint64_t* b)
+	{
+		if (const uint64_t x = a[0] ^ b[0]) {
+			return __builtin_clzll(x);
+		}
+		if (const uint64_t x = a[1] ^ b[1]) {
+			return 64 + __builtin_clzll(x);
+		}
+		return 128;
+	}
+}
+
+Ip_prefix_set::Ip_prefix_set ()
+{
+	clear();
+}
+
+void	Ip_prefix_set::clear ()
+{
+	const uint64_t		zero[2] = { 0, 0 };
+	nodes.clear();
+	num_prefixes = 0;
+	new_node(zero, 0, false);
+}
+
+uint32_t	Ip_prefix_set::new_node (const uint64_t* bits, unsigned int len, bool member)
+{
+	Node			node;
+	node.bits[0] = bits[0];
+	node.bits[1] = bits[1];
+	node.children[0] = node.children[1] = 0;
+	node.len = len;
+	node.member = member;
+	nodes.push_back(node);
+	return nodes.size() - 1;
+}
+
+void	Ip_prefix_set::add (const struct in6_addr& address, unsigned int prefix_len)
+{
+	uint64_t		bits[2];
+	load_address(bits, address);
+	truncate(bits, prefix_len);
+	++num_prefixes;
+
+	// Invariant: nodes[n] is a prefix of the new prefix (and no longer than it)
+	uint32_t		n = 0;
+	for (;;) {
+		if (nodes[n].member) {
+			return;		// already covered
+		}
+		if (nodes[n].len == prefix_len) {
+			// The prefix covers everything below it, which is no longer needed
+			// (the nodes are left unreferenced in the vector)
+			nodes[n].member = true;
+			nodes[n].children[0] = nodes[n].children[1] = 0;
+			return;
+		}
+
+		const unsigned int	b = bit_at(bits, nodes[n].len);
+		const uint32_t		c = nodes[n].children[b];
+		if (!c) {
+			const uint32_t	leaf = new_node(bits, prefix_len, true);
+			nodes[n].children[b] = leaf;
+			return;
+		}
+
+		const unsigned int	child_len = nodes[c].len;
+		unsigned int		common_len = common_prefix_len(bits, nodes[c].bits);
+		if (common_len > prefix_len) {
+			common_len = prefix_len;
+		}
+		if (common_len >= child_len) {
+			n = c;		// the child is a prefix of the new prefix too
+			continue;
+		}
+
+		if (common_len == prefix_len) {
+			// The new prefix sits between n and the child, and covers the child
+			const uint32_t	leaf = new_node(bits, prefix_len, true);
+			nodes[n].children[b] = leaf;
+			return;
+		}
+
+		// The new prefix and the child diverge after common_len bits:
+		// put a branch node there, with the two of them as its children
+		uint64_t		branch_bits[2] = { bits[0], bits[1] };
+		truncate(branch_bits, common_len);
+		const uint32_t		branch = new_node(branch_bits, common_len, false);
+		const uint32_t		leaf = new_node(bits, prefix_len, true);
+		nodes[branch].children[bit_at(nodes[c].bits, common_len)] = c;
+		nodes[branch].children[bit_at(bits, common_len)] = leaf;
+		nodes[n].children[b] = branch;
+		return;
+	}
+}
+
+bool	Ip_prefix_set::contains (const struct in6_addr& address) const
+{
+	uint64_t		bits[2];
+	load_address(bits, address);
+
+	const Node*		node = &nodes[0];
+	for (;;) {
+		if (node->member) {
+			return true;
+		}
+		if (node->len == 128) {
+			return false;
+		}
+		const uint32_t		c = node->children[bit_at(bits, node->len)];
+		if (!c) {
+			return false;
+		}
+		node = &nodes[c];
+		if (common_prefix_len(bits, node->bits) < node->len) {
+			return false;
+		}
+	}
+}
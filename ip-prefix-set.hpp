@@ -0,0 +1,76 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef BATV_IP_PREFIX_SET_HPP
+#define BATV_IP_PREFIX_SET_HPP
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+namespace batv {
+	// A set of IPv6 prefixes (IPv4 prefixes go in as IPv4-mapped addresses),
+	// answering whether an address is covered by any of them.  It's a
+	// path-compressed binary trie (a Patricia trie): every node is a prefix,
+	// and a node's children are the longer prefixes that diverge from each
+	// other at the bit after it, so a lookup visits at most one node per
+	// branching bit of the address, however many prefixes there are.
+	//
+	// Since only membership matters, a prefix covered by a shorter one isn't
+	// stored, and a lookup stops at the first (shortest) covering prefix.
+	class Ip_prefix_set {
+		struct Node {
+			uint64_t	bits[2];	// the prefix, high half first, with the bits after len zeroed
+			uint32_t	children[2];	// index into nodes, or 0 if none (node 0 is the root)
+			uint8_t		len;		// prefix length, 0-128
+			bool		member;		// is this prefix in the set? (if so, it has no children)
+		};
+
+		std::vector<Node>	nodes;		// nodes[0] is the root, the empty prefix
+		size_t			num_prefixes;	// as added, including ones already covered
+
+		uint32_t		new_node (const uint64_t* bits, unsigned int len, bool member);
+	public:
+		Ip_prefix_set ();
+
+		// Add address/prefix_len (prefix_len is 0-128; bits after it are ignored)
+		void			add (const struct in6_addr& address, unsigned int prefix_len);
+
+		bool			contains (const struct in6_addr& address) const;
+
+		bool			empty () const { return num_prefixes == 0; }
+		size_t			size () const { return num_prefixes; }
+		size_t			node_count () const { return nodes.size(); }	// including unreferenced ones
+		void			clear ();
+	};
+}
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "key-cache.hpp"
+#include "util.hpp"
+#include <cstring>
+
+using namespace batv;
+
+namespace {
+	// Holds a mutex locked for the lifetime of the object
+	class Mutex_lock {
+		pthread_mutex_t*	mutex;
+
+		Mutex_lock (const Mutex_lock&);
+		Mutex_lock& operator= (const Mutex_lock&);
+	public:
+		explicit Mutex_lock (pthread_mutex_t* arg_mutex) : mutex(arg_mutex) { pthread_mutex_lock(mutex); }
+		~Mutex_lock () { pthread_mutex_unlock(mutex); }
+	};
+
+	inline uint64_t fnv1a (uint64_t hash, char c)
+	{
+		return (hash ^ static_cast<unsigned char>(c)) * UINT64_C(0x100000001B3);
+	}
+
+	// Does address (as stored in an Entry) equal local_part@domain, with domain lowercased?
+	bool address_equals (const std::string& address, String_view local_part, String_view domain)
+	{
+		if (address.size() != local_part.size + (domain.empty() ? 0 : 1 + domain.size)) {
+			return false;
+		}
+		if (std::memcmp(address.data(), local_part.data, local_part.size) != 0) {
+			return false;
+		}
+		if (domain.empty()) {
+			return true;
+		}
+		const char*	a = address.data() + local_part.size;
+		if (*a++ != '@') {
+			return false;
+		}
+		for (const char* p = domain.begin(); p != domain.end(); ++p) {
+			if (*a++ != ascii_tolower(*p)) {
+				return false;
+			}
+		}
+		return true;
+	}
+}
+
+Key_cache::Key_cache (size_t arg_capacity)
+: capacity(arg_capacity ? arg_capacity : 1), head(0), tail(0)
+{
+	pthread_mutex_init(&mutex, NULL);
+}
+
+Key_cache::~Key_cache ()
+{
+	pthread_mutex_destroy(&mutex);
+}
+
+void	Key_cache::unlink (uint32_t node)
+{
+	Node&			n(nodes[node - 1]);
+	if (n.prev) {
+		nodes[n.prev - 1].next = n.next;
+	} else {
+		head = n.next;
+	}
+	if (n.next) {
+		nodes[n.next - 1].prev = n.prev;
+	} else {
+		tail = n.prev;
+	}
+	n.prev = n.next = 0;
+}
+
+void	Key_cache::push_front (uint32_t node)
+{
+	Node&			n(nodes[node - 1]);
+	n.prev = 0;
+	n.next = head;
+	if (head) {
+		nodes[head - 1].prev = node;
+	} else {
+		tail = node;
+	}
+	head = node;
+}
+
+void	Key_cache::get (uint32_t source_index, const std::string& source, Key* out)
+{
+	{
+		Mutex_lock	lock(&mutex);
+		if (source_index < source_nodes.size() && source_nodes[source_index]) {
+			const uint32_t	node = source_nodes[source_index];
+			if (node != head) {
+				unlink(node);
+				push_front(node);
+			}
+			*out = nodes[node - 1].key;
+			return;
+		}
+	}
+
+	// Load the key without holding the lock, since it may mean waiting on I/O.
+	// (If another thread loads the same key meanwhile, one of the copies wins.)
+	load_key_value(*out, source);
+
+	Mutex_lock		lock(&mutex);
+	if (source_index >= source_nodes.size()) {
+		source_nodes.resize(source_index + 1, 0);
+	}
+	uint32_t		node = source_nodes[source_index];
+	if (node) {
+		unlink(node);
+	} else if (nodes.size() < capacity) {
+		nodes.push_back(Node());
+		node = nodes.size();
+	} else {
+		// Evict the least recently used key and reuse its node
+		node = tail;
+		unlink(node);
+		source_nodes[nodes[node - 1].source] = 0;
+	}
+	source_nodes[source_index] = node;
+	nodes[node - 1].source = source_index;
+	nodes[node - 1].key = *out;
+	push_front(node);
+}
+
+Derived_key_cache::Derived_key_cache (size_t capacity)
+{
+	size_t			size = 1;
+	while (size < capacity) {
+		size *= 2;
+	}
+	const Entry		empty_entry = { 0, std::string(), 0, NULL };
+	entries.assign(size, empty_entry);
+	for (size_t i = 0; i < NUM_LOCKS; ++i) {
+		pthread_mutex_init(&locks[i], NULL);
+	}
+}
+
+Derived_key_cache::~Derived_key_cache ()
+{
+	for (size_t i = 0; i < entries.size(); ++i) {
+		delete entries[i].key;
+	}
+	for (size_t i = 0; i < NUM_LOCKS; ++i) {
+		pthread_mutex_destroy(&locks[i]);
+	}
+}
+
+void	Derived_key_cache::get (const Key& master, String_view local_part, String_view domain, Key* out)
+{
+	const unsigned int	num = master.get_num();
+
+	// 64-bit FNV-1a of local_part@domain (with lowercased domain), then the key-num.
+	// Hashed and compared in place, so a cache hit doesn't allocate.
+	uint64_t		hash = UINT64_C(0xCBF29CE484222325);
+	for (const char* p = local_part.begin(); p != local_part.end(); ++p) {
+		hash = fnv1a(hash, *p);
+	}
+	if (!domain.empty()) {
+		hash = fnv1a(hash, '@');
+		for (const char* p = domain.begin(); p != domain.end(); ++p) {
+			hash = fnv1a(hash, ascii_tolower(*p));
+		}
+	}
+	hash = (hash ^ num) * UINT64_C(0x100000001B3);
+
+	const size_t		index = hash & (entries.size() - 1);
+	Entry&			entry(entries[index]);
+	pthread_mutex_t*	lock = &locks[index % NUM_LOCKS];
+	{
+		Mutex_lock	l(lock);
+		if (entry.key && entry.hash == hash && entry.num == num && address_equals(entry.address, local_part, domain)) {
+			*out = *entry.key;
+			return;
+		}
+	}
+
+	// Derive the key without holding the lock
+	derive_key(*out, master, local_part, domain);
+
+	Mutex_lock		l(lock);
+	if (entry.key) {
+		*entry.key = *out;
+	} else {
+		entry.key = new Key(*out);
+	}
+	entry.hash = hash;
+	entry.address.assign(local_part.data, local_part.size);
+	if (!domain.empty()) {
+		entry.address.push_back('@');
+		for (const char* p = domain.begin(); p != domain.end(); ++p) {
+			entry.address.push_back(ascii_tolower(*p));
+		}
+	}
+	entry.num = num;
+}
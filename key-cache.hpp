@@ -0,0 +1,112 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef BATV_KEY_CACHE_HPP
+#define BATV_KEY_CACHE_HPP
+
+#include "key.hpp"
+#include "util.hpp"
+#include <vector>
+#include <string>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+namespace batv {
+	// A bounded cache of keys which are loaded on first use, for lazy key
+	// maps.  When full, the least recently used key is evicted.  Keys are
+	// identified by a small integer (an index into the key map's list of
+	// key sources), so no hashing is needed.  Safe to use from multiple
+	// threads: since another thread may evict a key at any moment, get()
+	// copies the key out instead of returning a pointer into the cache.
+	class Key_cache {
+		struct Node {
+			uint32_t	source;		// source index of the key in this node
+			uint32_t	prev;		// toward most recently used; index into nodes, plus one (0 = none)
+			uint32_t	next;		// toward least recently used; ditto
+			Key		key;
+		};
+
+		pthread_mutex_t		mutex;
+		size_t			capacity;
+		std::vector<Node>	nodes;		// grows up to capacity
+		std::vector<uint32_t>	source_nodes;	// node of each source index, plus one (0 = not cached)
+		uint32_t		head;		// most recently used node, plus one
+		uint32_t		tail;		// least recently used node, plus one
+
+		void			unlink (uint32_t node);
+		void			push_front (uint32_t node);
+
+		Key_cache (const Key_cache&);		// not copyable
+		Key_cache& operator= (const Key_cache&);
+	public:
+		explicit Key_cache (size_t capacity);	// capacity must be at least 1
+		~Key_cache ();
+
+		// Copy the key with the given source index into *out, first loading
+		// it from source (see load_key_value) if it isn't cached.  Throws
+		// Initialization_error if the key can't be loaded.
+		void			get (uint32_t source_index, const std::string& source, Key* out);
+	};
+
+	// A cache of keys derived from master keys (see derive_key), so that
+	// looking up a busy address doesn't cost an HMAC and a key schedule each
+	// time.  It's direct-mapped on a hash of the address and key-num, which
+	// identify the key since a key map gives an address at most one master
+	// key per number; a new key simply replaces whatever was in its entry.
+	// The entries are guarded by a set of striped locks, so threads looking
+	// up different addresses rarely contend.
+	class Derived_key_cache {
+		struct Entry {
+			uint64_t	hash;		// of address and num
+			std::string	address;	// local_part@domain, with lowercased domain
+			unsigned int	num;
+			Key*		key;		// owned; NULL if the entry is empty
+		};
+		enum {
+			NUM_LOCKS = 64
+		};
+
+		pthread_mutex_t		locks[NUM_LOCKS];	// entry i is guarded by locks[i % NUM_LOCKS]
+		std::vector<Entry>	entries;		// size is a power of 2
+
+		Derived_key_cache (const Derived_key_cache&);		// not copyable
+		Derived_key_cache& operator= (const Derived_key_cache&);
+	public:
+		explicit Derived_key_cache (size_t capacity);	// rounded up to a power of 2
+		~Derived_key_cache ();
+
+		// Copy the key that master derives for local_part@domain into *out,
+		// deriving it if it isn't cached.  out may point to master.
+		void			get (const Key& master, String_view local_part, String_view domain, Key* out);
+	};
+}
+
+#endif
@@ -0,0 +1,739 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "key-map.hpp"
+#include "compiled-key-map.hpp"
+#include "key-cache.hpp"
+#include "address.hpp"
+#include "common.hpp"
+#include <fstream>
+#include <limits>
+#include <algorithm>
+#include <map>
+#include <new>
+#include <cstring>
+
+using namespace batv;
+
+namespace {
+	// 64-bit FNV-1a, fed a piece at a time
+	struct Name_hash {
+		uint64_t	value;
+
+		Name_hash () : value(UINT64_C(0xCBF29CE484222325)) { }
+
+		void		add (char c)
+		{
+			value = (value ^ static_cast<unsigned char>(c)) * UINT64_C(0x100000001B3);
+		}
+		void		add (String_view str)
+		{
+			for (const char* p = str.begin(); p != str.end(); ++p) {
+				add(*p);
+			}
+		}
+		void		add_lowercase (String_view str)
+		{
+			for (const char* p = str.begin(); p != str.end(); ++p) {
+				add(ascii_tolower(*p));
+			}
+		}
+	};
+
+	// Does the NUL-terminated string at *other start with str?  If so,
+	// advance *other past it.  (Stops at the NUL, so doesn't over-read.)
+	bool		consume_prefix (const char** other, String_view str, bool lowercase)
+	{
+		const char*	p = *other;
+		for (size_t i = 0; i < str.size; ++i) {
+			if (p[i] == '\0' || p[i] != (lowercase ? ascii_tolower(str.data[i]) : str.data[i])) {
+				return false;
+			}
+		}
+		*other = p + str.size;
+		return true;
+	}
+
+	// The matchers below describe a name being looked up without building
+	// it as a string.  Each one feeds the name to a Name_hash (add_to), and
+	// matches it against the start of a stored name (consume).
+	template<class Derived> struct Name_matcher {
+		uint64_t	hash () const
+		{
+			Name_hash	h;
+			static_cast<const Derived*>(this)->add_to(h);
+			return h.value;
+		}
+		bool		operator== (const char* other) const	// other is NUL-terminated
+		{
+			return static_cast<const Derived*>(this)->consume(&other) && *other == '\0';
+		}
+	};
+
+	// A name without an '@', compared exactly
+	struct Plain_name : Name_matcher<Plain_name> {
+		String_view	name;
+
+		explicit Plain_name (String_view arg_name) : name(arg_name) { }
+
+		void		add_to (Name_hash& h) const { h.add(name); }
+		bool		consume (const char** other) const { return consume_prefix(other, name, false); }
+	};
+
+	const String_view	WILDCARD_PREFIX("@*.", 3);
+	const char		KEY_NUM_MARKER = '\x01';	// can't appear in an address
+
+	// Referenced key files are read by this many threads at once, since on
+	// network storage the time goes to waiting on each open and read
+	const unsigned int	KEY_LOADER_THREADS = 8;
+
+	// How many derived keys (see Key_map::derive_key) to cache
+	const size_t		DERIVED_KEY_CACHE_SIZE = 4096;
+
+	// Introduces a master key in a key map value
+	const String_view	MASTER_KEY_PREFIX("derive", 6);
+
+	// The distinct key values (file paths or inline hex keys) in a key map
+	struct Key_sources {
+		std::vector<std::string>	values;
+		std::vector<unsigned int>	nums;		// key-num of each key (see Key::get_num)
+		std::vector<bool>		masters;	// whether each key is a master key (see Key::is_master)
+		std::vector<Key>		keys;
+		std::vector<std::string>	errors;		// empty if the key loaded
+	};
+
+	void		load_key_source (void* arg, size_t i)
+	{
+		Key_sources*	sources = static_cast<Key_sources*>(arg);
+		try {
+			load_key_value(sources->keys[i], sources->values[i]);
+		} catch (const Initialization_error& e) {
+			sources->errors[i] = e.message;
+		} catch (const std::bad_alloc&) {
+			sources->errors[i] = "Out of memory loading key " + sources->values[i];
+		}
+	}
+
+	// "@*.suffix", with the suffix compared case-insensitively
+	struct Wildcard_name : Name_matcher<Wildcard_name> {
+		String_view	suffix;
+
+		explicit Wildcard_name (String_view arg_suffix) : suffix(arg_suffix) { }
+
+		void		add_to (Name_hash& h) const
+		{
+			h.add(WILDCARD_PREFIX);
+			h.add_lowercase(suffix);
+		}
+		bool		consume (const char** other) const	// *other has a lowercase domain
+		{
+			return consume_prefix(other, WILDCARD_PREFIX, false) && consume_prefix(other, suffix, true);
+		}
+	};
+
+	// The bit in Key_map::wildcard_depths for a suffix of the given number of labels
+	inline uint32_t	wildcard_depth_bit (size_t labels)
+	{
+		return UINT32_C(1) << (labels < 32 ? labels - 1 : 31);
+	}
+
+	// local_part@domain, with the domain compared case-insensitively
+	struct Address_name : Name_matcher<Address_name> {
+		String_view	local_part;
+		String_view	domain;
+
+		Address_name (String_view arg_local_part, String_view arg_domain) : local_part(arg_local_part), domain(arg_domain) { }
+
+		void		add_to (Name_hash& h) const
+		{
+			h.add(local_part);
+			h.add('@');
+			h.add_lowercase(domain);
+		}
+		bool		consume (const char** other) const	// *other has a lowercase domain
+		{
+			return consume_prefix(other, local_part, false) && *(*other)++ == '@' &&
+				consume_prefix(other, domain, true);
+		}
+	};
+
+	// A name followed by KEY_NUM_MARKER and a key-num digit.  A name's keys
+	// other than its current one are stored under these names.
+	template<class Name> struct Numbered_name : Name_matcher<Numbered_name<Name> > {
+		const Name&	name;
+		char		suffix[2];
+
+		Numbered_name (const Name& arg_name, unsigned int key_num) : name(arg_name)
+		{
+			suffix[0] = KEY_NUM_MARKER;
+			suffix[1] = '0' + key_num;
+		}
+
+		void		add_to (Name_hash& h) const
+		{
+			name.add_to(h);
+			h.add(String_view(suffix, suffix + 2));
+		}
+		bool		consume (const char** other) const
+		{
+			return name.consume(other) && consume_prefix(other, String_view(suffix, suffix + 2), false);
+		}
+	};
+}
+
+template<class Name> size_t Key_map::slot_index (const Name& name, uint64_t hash) const
+{
+	if (slots.empty()) {
+		return slots.size();
+	}
+	const size_t		mask = slots.size() - 1;
+	for (size_t i = hash & mask; slots[i].key; i = (i + 1) & mask) {
+		if (slots[i].hash == hash && name == &names[slots[i].name_offset]) {
+			return i;
+		}
+	}
+	return slots.size();
+}
+
+template<class Name> const Key_map::Slot* Key_map::find_slot (const Name& name, uint64_t hash) const
+{
+	const size_t		i = slot_index(name, hash);
+	return i < slots.size() ? &slots[i] : NULL;
+}
+
+template<class Name> Key_map::Slot* Key_map::find_slot (const Name& name, uint64_t hash)
+{
+	const size_t		i = slot_index(name, hash);
+	return i < slots.size() ? &slots[i] : NULL;
+}
+
+const Key*	Key_map::get_key_at (uint32_t key_index, Key* lazy_key) const
+{
+	if (!(key_index & LAZY_KEY)) {
+		return &keys[key_index];
+	}
+	if (!lazy_key) {
+		throw Initialization_error("Lazy key map looked up without anywhere to put the key");
+	}
+	key_index &= ~LAZY_KEY;
+	const Lazy_key&		lazy(lazy_keys[key_index]);
+	lazy_cache->get(key_index, lazy.source, lazy_key);
+	lazy_key->set_num(lazy.num);
+	lazy_key->set_master(lazy.master);
+	return lazy_key;
+}
+
+unsigned int	Key_map::key_num_of (uint32_t key_index) const
+{
+	return key_index & LAZY_KEY ? lazy_keys[key_index & ~LAZY_KEY].num : keys[key_index].get_num();
+}
+
+template<class Name> const Key* Key_map::find_key (const Name& name, Key* lazy_key, int key_num) const
+{
+	const uint64_t		hash = name.hash();
+
+	if (const Slot* slot = find_slot(name, hash)) {
+		uint32_t	key_index = slot->key - 1;
+		if (key_num != CURRENT_KEY && key_num_of(key_index) != static_cast<unsigned int>(key_num)) {
+			// Use the name's old key with that number, if it has one
+			const Numbered_name<Name>	numbered_name(name, key_num);
+			if (const Slot* numbered_slot = find_slot(numbered_name, numbered_name.hash())) {
+				key_index = numbered_slot->key - 1;
+			}
+		}
+		return get_key_at(key_index, lazy_key);
+	}
+
+	const char*		compiled_name;
+	uint32_t		compiled_key_index;
+	if (compiled && compiled->find(hash, &compiled_name, &compiled_key_index) && name == compiled_name) {
+		const Key*	key = compiled->get_key(compiled_key_index);
+		if (key && key_num != CURRENT_KEY && key->get_num() != static_cast<unsigned int>(key_num)) {
+			const Numbered_name<Name>	numbered_name(name, key_num);
+			if (compiled->find(numbered_name.hash(), &compiled_name, &compiled_key_index) && numbered_name == compiled_name) {
+				key = compiled->get_key(compiled_key_index);
+			}
+		}
+		return key;
+	}
+	return NULL;
+}
+
+Key_map::~Key_map ()
+{
+	delete lazy_cache;
+	delete derived_cache;
+	delete compiled;
+}
+
+void	Key_map::clear ()
+{
+	keys.clear();
+	key_hashes.clear();
+	key_slots.clear();
+	entries.clear();
+	names.clear();
+	slots.clear();
+	wildcard_depths = 0;
+	lazy_keys.clear();
+	has_master_keys = false;
+	delete lazy_cache;
+	lazy_cache = NULL;
+	delete derived_cache;
+	derived_cache = NULL;
+	delete compiled;
+	compiled = NULL;
+}
+
+void	Key_map::set_lazy (size_t cache_size)
+{
+	if (lazy_cache) {
+		throw Initialization_error("Key map is already lazy");
+	}
+	lazy_cache = new Key_cache(cache_size);
+}
+
+uint32_t	Key_map::add_lazy_key (const std::string& source, unsigned int num, bool master)
+{
+	if (lazy_keys.size() >= LAZY_KEY) {
+		throw Initialization_error("Too many key files in lazy key map");
+	}
+	Lazy_key		lazy;
+	lazy.source = source;
+	lazy.num = num;
+	lazy.master = master;
+	lazy_keys.push_back(lazy);
+	has_master_keys |= master;
+	return (lazy_keys.size() - 1) | LAZY_KEY;
+}
+
+bool	Key_map::copies_keys () const
+{
+	return lazy_cache || has_master_keys || (compiled && compiled->has_master_keys());
+}
+
+const Key*	Key_map::derive_key (const Key& master, String_view local_part, String_view domain, Key* out) const
+{
+	if (!out) {
+		throw Initialization_error("Master key looked up without anywhere to put the derived key");
+	}
+
+	Derived_key_cache*	cache = __atomic_load_n(&derived_cache, __ATOMIC_ACQUIRE);
+	if (!cache) {
+		// Another thread may have beaten us to it, in which case use its cache
+		Derived_key_cache*	new_cache = new Derived_key_cache(DERIVED_KEY_CACHE_SIZE);
+		if (__atomic_compare_exchange_n(&derived_cache, &cache, new_cache, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			cache = new_cache;
+		} else {
+			delete new_cache;
+		}
+	}
+	cache->get(master, local_part, domain, out);
+	return out;
+}
+
+void	Key_map::load_compiled (const std::string& path)
+{
+	if (compiled) {
+		throw Initialization_error("Only one compiled key map can be used (" + path + ")");
+	}
+	compiled = new Compiled_key_map(path);
+}
+
+void	Key_map::insert_slot (const Slot& slot)
+{
+	const size_t		mask = slots.size() - 1;
+	size_t			i = slot.hash & mask;
+	while (slots[i].key) {
+		i = (i + 1) & mask;
+	}
+	slots[i] = slot;
+}
+
+void	Key_map::grow ()
+{
+	std::vector<Slot>	old_slots;
+	old_slots.swap(slots);
+
+	const Slot		empty_slot = { 0, 0, 0 };
+	slots.assign(old_slots.empty() ? 16 : old_slots.size() * 2, empty_slot);
+
+	for (size_t i = 0; i < old_slots.size(); ++i) {
+		if (old_slots[i].key) {
+			insert_slot(old_slots[i]);
+		}
+	}
+}
+
+void	Key_map::grow_key_slots ()
+{
+	key_slots.assign(key_slots.empty() ? 16 : key_slots.size() * 2, 0);
+
+	const size_t		mask = key_slots.size() - 1;
+	for (size_t k = 0; k < keys.size(); ++k) {
+		size_t		i = key_hashes[k] & mask;
+		while (key_slots[i]) {
+			i = (i + 1) & mask;
+		}
+		key_slots[i] = k + 1;
+	}
+}
+
+uint32_t	Key_map::intern_key (const Key& key)
+{
+	const std::vector<unsigned char>&	bytes(key.get_bytes());
+	Name_hash				hash;
+	for (size_t i = 0; i < bytes.size(); ++i) {
+		hash.add(static_cast<char>(bytes[i]));
+	}
+	hash.add(static_cast<char>(key.get_num()));	// the same bytes with another key-num is another key
+	hash.add(key.is_master() ? 'M' : '\0');
+
+	if (!key_slots.empty()) {
+		const size_t	mask = key_slots.size() - 1;
+		for (size_t i = hash.value & mask; key_slots[i]; i = (i + 1) & mask) {
+			const uint32_t	k = key_slots[i] - 1;
+			if (key_hashes[k] == hash.value && keys[k].get_bytes() == bytes &&
+					keys[k].get_num() == key.get_num() && keys[k].is_master() == key.is_master()) {
+				return k;
+			}
+		}
+	}
+
+	if ((keys.size() + 1) * 2 > key_slots.size()) {
+		grow_key_slots();
+	}
+	const size_t		mask = key_slots.size() - 1;
+	size_t			i = hash.value & mask;
+	while (key_slots[i]) {
+		i = (i + 1) & mask;
+	}
+	key_slots[i] = keys.size() + 1;
+	keys.push_back(key);
+	has_master_keys |= key.is_master();
+	key_hashes.push_back(hash.value);
+	return keys.size() - 1;
+}
+
+namespace {
+	struct Entry_name_offset_less {
+		template<class Entry> bool operator() (const Entry& entry, uint32_t name_offset) const { return entry.name_offset < name_offset; }
+	};
+}
+
+void	Key_map::insert (String_view name, uint32_t key_index)
+{
+	if (const char* at_sign_p = static_cast<const char*>(std::memchr(name.data, '@', name.size))) {
+		insert_name(Address_name(String_view(name.begin(), at_sign_p), String_view(at_sign_p + 1, name.end())), name, at_sign_p, key_index);
+	} else {
+		insert_name(Plain_name(name), name, NULL, key_index);
+	}
+}
+
+template<class Name> void Key_map::insert_name (const Name& name, String_view raw_name, const char* at_sign_p, uint32_t key_index)
+{
+	if (const Slot* existing = find_slot(name, name.hash())) {
+		const unsigned int	old_num = key_num_of(existing->key - 1);
+		if (old_num != key_num_of(key_index)) {
+			// Keep the old key around to validate the tags it signed
+			put_name(Numbered_name<Name>(name, old_num), raw_name, at_sign_p, old_num, existing->key - 1);
+		}
+	}
+	put_name(name, raw_name, at_sign_p, CURRENT_KEY, key_index);
+}
+
+template<class Name> void Key_map::put_name (const Name& name, String_view raw_name, const char* at_sign_p, int key_num, uint32_t key_index)
+{
+	const uint64_t		hash = name.hash();
+
+	if (Slot* existing = find_slot(name, hash)) {
+		existing->key = key_index + 1;
+		// Entries are in order of name_offset
+		std::lower_bound(entries.begin(), entries.end(), existing->name_offset, Entry_name_offset_less())->key = key_index;
+		return;
+	}
+
+	if ((entries.size() + 1) * 2 > slots.size()) {
+		grow();
+	}
+
+	Slot			slot;
+	slot.hash = hash;
+	slot.key = key_index + 1;
+	slot.name_offset = names.size();
+
+	// Lowercase the domain (everything after the first '@')
+	if (at_sign_p) {
+		names.insert(names.end(), raw_name.begin(), at_sign_p + 1);
+		for (const char* p = at_sign_p + 1; p != raw_name.end(); ++p) {
+			names.push_back(ascii_tolower(*p));
+		}
+	} else {
+		names.insert(names.end(), raw_name.begin(), raw_name.end());
+	}
+	if (key_num != CURRENT_KEY) {
+		names.push_back(KEY_NUM_MARKER);
+		names.push_back('0' + key_num);
+	}
+	names.push_back('\0');
+
+	if (raw_name.size > WILDCARD_PREFIX.size && std::memcmp(raw_name.data, WILDCARD_PREFIX.data, WILDCARD_PREFIX.size) == 0) {
+		const char*	suffix = raw_name.data + WILDCARD_PREFIX.size;
+		wildcard_depths |= wildcard_depth_bit(1 + std::count(suffix, raw_name.end(), '.'));
+	}
+
+	insert_slot(slot);
+
+	Entry			entry;
+	entry.name_offset = slot.name_offset;
+	entry.key = key_index;
+	entries.push_back(entry);
+}
+
+const Key*	Key_map::find (String_view name, Key* lazy_key, int key_num) const
+{
+	if (const char* at_sign_p = static_cast<const char*>(std::memchr(name.data, '@', name.size))) {
+		return find_key(Address_name(String_view(name.begin(), at_sign_p), String_view(at_sign_p + 1, name.end())), lazy_key, key_num);
+	} else {
+		return find_key(Plain_name(name), lazy_key, key_num);
+	}
+}
+
+const Key*	Key_map::find (String_view local_part, String_view domain, Key* lazy_key, int key_num) const
+{
+	return find_key(Address_name(local_part, domain), lazy_key, key_num);
+}
+
+const Key*	Key_map::find_wildcard (String_view domain, Key* lazy_key, int key_num) const
+{
+	const uint32_t		depths = wildcard_depths | (compiled ? compiled->get_wildcard_depths() : 0);
+	if (!depths) {
+		return NULL;
+	}
+
+	// Try the suffix after each dot, most labels first
+	size_t			labels = 1 + std::count(domain.begin(), domain.end(), '.');
+	for (const char* p = domain.begin(); p != domain.end(); ++p) {
+		if (*p == '.') {
+			--labels;
+			if (depths & wildcard_depth_bit(labels)) {
+				if (const Key* key = find_key(Wildcard_name(String_view(p + 1, domain.end())), lazy_key, key_num)) {
+					return key;
+				}
+			}
+		}
+	}
+	return NULL;
+}
+
+uint64_t	batv::hash_key_map_name (String_view name)
+{
+	Name_hash	h;
+	h.add(name);
+	return h.value;
+}
+
+void	batv::load_key_map (Key_map& key_map, std::istream& in)
+{
+	// First parse the entries, so the key files can be loaded all at once
+	std::vector<std::string>		addresses;
+	std::vector<size_t>			source_indices;
+	Key_sources				sources;
+	typedef std::pair<std::pair<unsigned int, bool>, std::string> Source_id;	// num, master, value
+	std::map<Source_id, size_t>		source_index_by_id;
+
+	while (in.good() && in.peek() != -1) {
+		// Skip comments (lines starting with #) and blank lines
+		if (in.peek() == '#' || in.peek() == '\n') {
+			in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+			continue;
+		}
+
+		// read address/domain
+		std::string		address;
+		in >> address;
+
+		// skip whitespace
+		in >> std::ws;
+
+		// read optional key-num, optional "derive", then key file path or inline hex key
+		std::string		value;
+		std::getline(in, value);
+		chomp(value);
+
+		unsigned int		num = 0;
+		if (value.size() > 2 && value[0] >= '0' && value[0] <= '9' && (value[1] == ' ' || value[1] == '\t')) {
+			num = value[0] - '0';
+			value.erase(0, value.find_first_not_of(" \t", 1));
+		}
+		bool			master = false;
+		if (value.size() > MASTER_KEY_PREFIX.size && value.compare(0, MASTER_KEY_PREFIX.size, MASTER_KEY_PREFIX.data) == 0 &&
+				(value[MASTER_KEY_PREFIX.size] == ' ' || value[MASTER_KEY_PREFIX.size] == '\t')) {
+			master = true;
+			value.erase(0, value.find_first_not_of(" \t", MASTER_KEY_PREFIX.size));
+		}
+
+		if (is_inline_key_value(value)) {
+			if (const char* error = inline_key_value_error(value)) {
+				throw Initialization_error("Inline key for " + address + " " + error);
+			}
+		}
+
+		const Source_id				id(std::make_pair(num, master), value);
+		std::map<Source_id, size_t>::iterator	it(source_index_by_id.find(id));
+		if (it == source_index_by_id.end()) {
+			it = source_index_by_id.insert(std::make_pair(id, sources.values.size())).first;
+			sources.values.push_back(value);
+			sources.nums.push_back(num);
+			sources.masters.push_back(master);
+		}
+		addresses.push_back(address);
+		source_indices.push_back(it->second);
+	}
+
+	if (key_map.is_lazy()) {
+		std::vector<uint32_t>		source_keys(sources.values.size());
+		for (size_t i = 0; i < sources.values.size(); ++i) {
+			source_keys[i] = key_map.add_lazy_key(sources.values[i], sources.nums[i], sources.masters[i]);
+		}
+		for (size_t i = 0; i < addresses.size(); ++i) {
+			key_map.insert(String_view(addresses[i]), source_keys[source_indices[i]]);
+		}
+		return;
+	}
+
+	// Load each distinct key file once
+	sources.keys.resize(sources.values.size());
+	sources.errors.resize(sources.values.size());
+	run_in_parallel(sources.values.size(), KEY_LOADER_THREADS, load_key_source, &sources);
+
+	// Report the first failure in file order, as if they'd been loaded one by one
+	std::vector<uint32_t>			source_keys(sources.values.size());
+	for (size_t i = 0; i < sources.values.size(); ++i) {
+		if (sources.errors[i].empty()) {
+			sources.keys[i].set_num(sources.nums[i]);
+			sources.keys[i].set_master(sources.masters[i]);
+			source_keys[i] = key_map.intern_key(sources.keys[i]);
+		}
+	}
+	for (size_t i = 0; i < addresses.size(); ++i) {
+		if (!sources.errors[source_indices[i]].empty()) {
+			throw Initialization_error(sources.errors[source_indices[i]]);
+		}
+		key_map.insert(String_view(addresses[i]), source_keys[source_indices[i]]);
+	}
+}
+
+void	batv::load_key_map_file (Key_map& key_map, const std::string& path)
+{
+	if (Compiled_key_map::is_compiled(path)) {
+		key_map.load_compiled(path);
+		return;
+	}
+
+	std::ifstream	key_map_in(path.c_str());
+	if (!key_map_in) {
+		throw Initialization_error("Unable to open key map " + path);
+	}
+	load_key_map(key_map, key_map_in);
+}
+
+namespace {
+	// What get_key returns for a key found in the map: NULL for an empty key
+	// (which disables BATV), the derived key for a master key, or else key
+	const Key*	usable_key (const Key_map& keys, const Key* key, String_view local_part, String_view domain, Key* lazy_key)
+	{
+		if (key->empty()) {
+			return NULL;
+		}
+		if (key->is_master()) {
+			return keys.derive_key(*key, local_part, domain, lazy_key);
+		}
+		return key;
+	}
+}
+
+const Key* batv::get_key (const Key_map& keys, const std::string& sender_address, const Key* default_key, Key* lazy_key, int key_num)
+{
+	const Key*		key;
+
+	std::string::size_type	at_sign_pos = sender_address.find('@');
+	const String_view	local_part(sender_address.data(), at_sign_pos != std::string::npos ? at_sign_pos : sender_address.size());
+	const String_view	domain(at_sign_pos != std::string::npos ? sender_address.data() + at_sign_pos + 1 : sender_address.data() + sender_address.size(),
+				       sender_address.data() + sender_address.size());
+
+	// Look up the address itself
+	if ((key = keys.find(String_view(sender_address), lazy_key, key_num)) != NULL) {
+		return usable_key(keys, key, local_part, domain, lazy_key);
+	}
+
+	// Try looking up only the domain
+	if (at_sign_pos != std::string::npos) {
+		if ((key = keys.find(String_view(), domain, lazy_key, key_num)) != NULL) {
+			return usable_key(keys, key, local_part, domain, lazy_key);
+		}
+		// Try wildcard domains
+		if ((key = keys.find_wildcard(domain, lazy_key, key_num)) != NULL) {
+			return usable_key(keys, key, local_part, domain, lazy_key);
+		}
+	}
+
+	return default_key;
+}
+
+const Key* batv::get_key (const Key_map& keys, const Email_address_view& sender_address, const Key* default_key, Key* lazy_key, int key_num)
+{
+	const Key*		key;
+
+	if (sender_address.domain.empty()) {
+		// No domain, so there's nothing to look up but the address itself
+		if ((key = keys.find(sender_address.local_part, lazy_key, key_num)) != NULL) {
+			return usable_key(keys, key, sender_address.local_part, sender_address.domain, lazy_key);
+		}
+		return default_key;
+	}
+
+	// Look up the address itself
+	if ((key = keys.find(sender_address.local_part, sender_address.domain, lazy_key, key_num)) != NULL) {
+		return usable_key(keys, key, sender_address.local_part, sender_address.domain, lazy_key);
+	}
+
+	// Try looking up only the domain
+	if ((key = keys.find(String_view(), sender_address.domain, lazy_key, key_num)) != NULL) {
+		return usable_key(keys, key, sender_address.local_part, sender_address.domain, lazy_key);
+	}
+
+	// Try wildcard domains
+	if ((key = keys.find_wildcard(sender_address.domain, lazy_key, key_num)) != NULL) {
+		return usable_key(keys, key, sender_address.local_part, sender_address.domain, lazy_key);
+	}
+
+	return default_key;
+}
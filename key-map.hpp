@@ -0,0 +1,206 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef BATV_KEY_MAP_HPP
+#define BATV_KEY_MAP_HPP
+
+#include "key.hpp"
+#include "util.hpp"
+#include <vector>
+#include <string>
+#include <iosfwd>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace batv {
+	struct Email_address_view;
+	class Compiled_key_map;
+	class Key_cache;
+	class Derived_key_cache;
+
+	// Map from sender address ("user@example.com") or domain ("@example.com")
+	// to key.  This is a flat hash table with open addressing, so that a
+	// lookup doesn't need to allocate or do string compares down a tree.
+	// Domains are compared case-insensitively (they're ASCII-lowercased
+	// when inserted); local parts are case-sensitive.  A compiled key map
+	// (see compiled-key-map.hpp) can back the names that weren't inserted.
+	//
+	// Keys are interned: each distinct key is stored once, in one array, and
+	// entries refer to it by index.  So a domain's worth of addresses sharing
+	// a key file costs a slot and a name apiece, not a copy of the key.
+	//
+	// A domain name can be a wildcard: "@*.example.com" matches every
+	// subdomain of example.com (but not example.com itself).  These are
+	// stored like any other name; a lookup tries each suffix of the domain,
+	// longest first, skipping suffix lengths that no wildcard has.
+	//
+	// A lazy key map only records where each key comes from, and loads it
+	// into a bounded cache (see key-cache.hpp) the first time it's looked
+	// up.  Since the cache can evict a key at any time, lookups copy a lazy
+	// key into a Key supplied by the caller.
+	//
+	// A key can be a master key (see Key::is_master), typically for a domain,
+	// in which case get_key returns the key it derives for the address being
+	// looked up.  So a domain with any number of users needs only one entry.
+	//
+	// For key rollover, a name can have several keys with different key
+	// numbers (see Key::get_num).  The last one inserted is the current key,
+	// used for signing; when it replaces a key with another number, the old
+	// key is kept under a hidden name (the name plus "\x01" and the number),
+	// so a tag signed with it can still be validated.
+	class Key_map {
+		struct Slot {
+			uint64_t	hash;		// hash of the name, so almost no names need comparing
+			uint32_t	key;		// index into keys, plus one; 0 if the slot is empty
+			uint32_t	name_offset;	// offset of the name in names
+		};
+		struct Entry {
+			uint32_t	name_offset;	// entries are in order of name_offset
+			uint32_t	key;		// index into keys
+		};
+		struct Lazy_key {
+			std::string	source;		// key file path or hex key
+			unsigned int	num;		// see Key::get_num
+			bool		master;		// see Key::is_master
+		};
+
+		enum {
+			LAZY_KEY = 0x80000000	// set in a key index that's an index into lazy_keys
+		};
+
+		std::vector<Key>	keys;		// distinct keys
+		std::vector<uint64_t>	key_hashes;	// hash of each key's bytes
+		std::vector<uint32_t>	key_slots;	// index into keys, plus one; size is 0 or a power of 2, at most half full
+		std::vector<Entry>	entries;	// in order of insertion
+		std::vector<char>	names;		// NUL-terminated, with lowercased domains
+		std::vector<Slot>	slots;		// size is 0 or a power of 2, at most half full
+		std::vector<Lazy_key>	lazy_keys;
+		uint32_t		wildcard_depths;	// bit n-1 set if a wildcard's suffix has n labels (bit 31: 32 or more)
+		bool			has_master_keys;	// have any master keys been interned or added lazily?
+		Key_cache*		lazy_cache;	// owned; NULL unless lazy
+		mutable Derived_key_cache* derived_cache;	// owned; created by the first derive_key
+		Compiled_key_map*	compiled;	// owned; NULL if none
+
+		template<class Name> size_t slot_index (const Name&, uint64_t hash) const;	// slots.size() if not found
+		template<class Name> const Slot* find_slot (const Name&, uint64_t hash) const;
+		template<class Name> Slot* find_slot (const Name&, uint64_t hash);
+		template<class Name> const Key* find_key (const Name&, Key* lazy_key, int key_num) const;
+		template<class Name> void insert_name (const Name&, String_view raw_name, const char* at_sign_p, uint32_t key_index);
+		template<class Name> void put_name (const Name&, String_view raw_name, const char* at_sign_p, int key_num, uint32_t key_index);
+		const Key*		get_key_at (uint32_t key_index, Key* lazy_key) const;
+		unsigned int		key_num_of (uint32_t key_index) const;
+		void			insert_slot (const Slot&);
+		void			grow ();
+		void			grow_key_slots ();
+
+		Key_map (const Key_map&);		// not copyable
+		Key_map& operator= (const Key_map&);
+	public:
+		enum {
+			CURRENT_KEY = -1	// key_num meaning the current key, whatever its number
+		};
+
+		Key_map () : wildcard_depths(0), has_master_keys(false), lazy_cache(NULL), derived_cache(NULL), compiled(NULL) { }
+		~Key_map ();
+
+		// Add key to the distinct keys (unless an identical key is already
+		// there), returning its index
+		uint32_t		intern_key (const Key& key);
+
+		// Map name to the given key, replacing its old key if name is already in
+		// the map (but keeping the old key for its key-num if that's different)
+		void			insert (String_view name, uint32_t key_index);
+		void			insert (String_view name, const Key& key) { insert(name, intern_key(key)); }
+
+		// Make load_key_map add lazy keys from now on, keeping at most cache_size loaded at once
+		void			set_lazy (size_t cache_size);
+		bool			is_lazy () const { return lazy_cache != NULL; }
+
+		// Return the index of a key to be loaded from source (a key file
+		// path or hex key; see load_key_value) when it's first looked up
+		uint32_t		add_lazy_key (const std::string& source, unsigned int num =0, bool master =false);
+
+		// Do lookups (by get_key) copy keys into a Key supplied by the caller?
+		// True if the map is lazy or has master keys.
+		bool			copies_keys () const;
+
+		// Copy the key derived from master for local_part@domain (see
+		// batv::derive_key) into *out, which is returned, using a cache of
+		// recently derived keys.  Throws Initialization_error if out is NULL.
+		const Key*		derive_key (const Key& master, String_view local_part, String_view domain, Key* out) const;
+
+		// Use the compiled key map at path for names that aren't inserted
+		void			load_compiled (const std::string& path);
+
+		// If the name maps to a lazy key, it's copied into *lazy_key, which
+		// is returned.  Throws Initialization_error if a lazy key can't be
+		// loaded (or lazy_key is NULL).  If key_num isn't CURRENT_KEY, the
+		// name's key with that number is returned, or else its current key.
+		const Key*		find (String_view name, Key* lazy_key =NULL, int key_num =CURRENT_KEY) const;
+		const Key*		find (String_view local_part, String_view domain, Key* lazy_key =NULL, int key_num =CURRENT_KEY) const;	// local_part@domain
+		const Key*		find_wildcard (String_view domain, Key* lazy_key =NULL, int key_num =CURRENT_KEY) const;	// most specific "@*.suffix" matching domain
+
+		// The inserted names and their keys, in order of insertion (not
+		// including the compiled key map's).  Only for maps that aren't lazy.
+		size_t			size () const { return entries.size(); }
+		const char*		name_at (size_t i) const { return &names[entries[i].name_offset]; }
+		uint32_t		key_index_at (size_t i) const { return entries[i].key; }
+		const Key&		key_at (size_t i) const { return keys[entries[i].key]; }
+
+		// The distinct keys
+		size_t			num_keys () const { return keys.size(); }
+		const Key&		interned_key (uint32_t key_index) const { return keys[key_index]; }
+
+		uint32_t		get_wildcard_depths () const { return wildcard_depths; }
+
+		bool			empty () const { return entries.empty() && !compiled; }
+		void			clear ();
+	};
+
+	// The hash of a name, as stored (with lowercased domain)
+	uint64_t	hash_key_map_name (String_view name);
+
+	// If key_map is lazy, the key files aren't read yet (but inline hex keys are checked)
+	void		load_key_map (Key_map& key_map, std::istream& key_map_file_in);
+
+	// Load a key map file, which may be a text key map or a compiled key map
+	void		load_key_map_file (Key_map& key_map, const std::string& path);
+
+	// Get HMAC key for given sender from the key map:
+	//  returns default_key (which is NULL by default) if sender is not in map.
+	//  returns NULL if sender is in map with an empty key
+	//  returns the key derived for sender if sender is in map with a master key
+	// A lazy or derived key is copied into *lazy_key, and key_num picks one
+	// of the sender's keys (see Key_map::find).
+	const Key*	get_key (const Key_map&, const std::string& sender_address, const Key* default_key =NULL, Key* lazy_key =NULL, int key_num =Key_map::CURRENT_KEY);
+	const Key*	get_key (const Key_map&, const Email_address_view& sender_address, const Key* default_key =NULL, Key* lazy_key =NULL, int key_num =Key_map::CURRENT_KEY);
+}
+
+#endif
@@ -31,74 +31,167 @@
 #include "key.hpp"
 #include "common.hpp"
 #include "util.hpp"
-#include <fstream>
-#include <limits>
+#include <vector>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 using namespace batv;
 
+namespace {
+	// Prefixed to the address, so a derived key is never an HMAC of anything a tag is
+	const char	DERIVED_KEY_LABEL[] = "BATV derived key";
+
+	const String_view	INLINE_KEY_PREFIX("hex:", 4);
+}
+
+void	Key::assign (const unsigned char* data, size_t len)
+{
+	bytes.assign(data, data + len);
+	hmac_key.set(data, len);
+	hmac_sha256_key.set(data, len);
+}
+
+void	Key::assign (const unsigned char* data, size_t len, const uint32_t* sha1_midstates, const uint32_t* sha256_midstates)
+{
+	bytes.assign(data, data + len);
+	hmac_key.set_midstates(sha1_midstates, sha1_midstates + crypto::Sha1::State_type::STATE_WORDS);
+	hmac_sha256_key.set_midstates(sha256_midstates, sha256_midstates + crypto::Sha256::State_type::STATE_WORDS);
+}
+
+void	Key::clear ()
+{
+	if (!bytes.empty()) {
+		explicit_memzero(&bytes[0], bytes.size());
+	}
+	assign(NULL, 0);
+	num = 0;
+	master = false;
+}
+
+namespace {
+	// Read all of fd into bytes.  For a regular file, the buffer is sized from
+	// fstat, so this takes a single read() unless the file is growing.
+	bool		read_all (int fd, std::vector<unsigned char>& bytes)
+	{
+		struct stat	st;
+		const bool	is_regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+		size_t		len = 0;
+
+		// One byte extra, so a short read tells us we've hit EOF
+		bytes.resize(is_regular ? static_cast<size_t>(st.st_size) + 1 : 256);
+		for (;;) {
+			const ssize_t	n = read(fd, &bytes[len], bytes.size() - len);
+			if (n == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				explicit_memzero(&bytes[0], bytes.size());
+				return false;
+			}
+			len += n;
+			if (n == 0 || (is_regular && len < bytes.size())) {
+				break;
+			}
+			if (len == bytes.size()) {
+				// Don't let a reallocation leave a copy of the key behind
+				std::vector<unsigned char>	bigger(bytes.size() * 2);
+				std::memcpy(&bigger[0], &bytes[0], len);
+				explicit_memzero(&bytes[0], bytes.size());
+				bytes.swap(bigger);
+			}
+		}
+		bytes.resize(len);
+		return true;
+	}
+}
+
 void	batv::load_key (Key& key, const std::string& key_file_path)
 {
-	std::ifstream		key_file_in(key_file_path.c_str());
-	if (!key_file_in) {
+	const int		fd = open(key_file_path.c_str(), O_RDONLY);
+	if (fd == -1) {
 		throw Initialization_error("Unable to open key file " + key_file_path);
 	}
 
-	key.clear();
-	while (key_file_in.good() && key_file_in.peek() != -1) {
-		char	ch;
-		key_file_in.get(ch);
-		key.push_back(ch);
+	std::vector<unsigned char>	bytes;
+	const bool			ok = read_all(fd, bytes);
+	close(fd);
+	if (!ok) {
+		throw Initialization_error("Unable to read key file " + key_file_path);
 	}
-	if (key.empty()) {
+	if (bytes.empty()) {
 		throw Initialization_error("Key file " + key_file_path + " is empty");
 	}
+	key.assign(&bytes[0], bytes.size());
+	explicit_memzero(&bytes[0], bytes.size());
 }
 
-void	batv::load_key_map (Key_map& key_map, std::istream& in)
+bool	batv::is_inline_key_value (const std::string& value)
 {
-	while (in.good() && in.peek() != -1) {
-		// Skip comments (lines starting with #) and blank lines
-		if (in.peek() == '#' || in.peek() == '\n') {
-			in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
-			continue;
-		}
-
-		// read address/domain
-		std::string		address;
-		in >> address;
-
-		// skip whitespace
-		in >> std::ws;
-
-		// read key file path
-		std::string		key_file_path;
-		std::getline(in, key_file_path);
-		chomp(key_file_path);
+	return value.compare(0, INLINE_KEY_PREFIX.size, INLINE_KEY_PREFIX.data) == 0;
+}
 
-		// Load the keyfile 
-		load_key(key_map[address], key_file_path);
+const char*	batv::inline_key_value_error (const std::string& value)
+{
+	const size_t		hex_len = value.size() - INLINE_KEY_PREFIX.size;
+	if (value.find_first_not_of("0123456789abcdefABCDEF", INLINE_KEY_PREFIX.size) != std::string::npos) {
+		return "contains a character that isn't a hex digit";
 	}
+	if (hex_len % 2 != 0) {
+		return "has an odd number of hex digits";
+	}
+	if (hex_len / 2 < MIN_INLINE_KEY_LENGTH) {
+		return "is too short (must be at least 16 bytes, i.e. 32 hex digits)";
+	}
+	return NULL;
 }
 
-const Key* batv::get_key (const Key_map& keys, const std::string& sender_address, const Key* default_key)
+void	batv::load_key_value (Key& key, const std::string& value)
 {
-	Key_map::const_iterator		it;
+	if (!is_inline_key_value(value)) {
+		load_key(key, value);
+		return;
+	}
 
-	// Look up the address itself
-	it = keys.find(sender_address);
-	if (it != keys.end()) {
-		return !it->second.empty() ? &it->second : NULL;
+	// Errors don't echo the value back, since it's a key
+	if (const char* error = inline_key_value_error(value)) {
+		throw Initialization_error(std::string("Inline key ") + error);
 	}
+	const size_t			hex_len = value.size() - INLINE_KEY_PREFIX.size;
+	std::vector<unsigned char>	bytes(hex_len / 2);
+	decode_hex(value.data() + INLINE_KEY_PREFIX.size, hex_len, &bytes[0]);
+	key.assign(&bytes[0], bytes.size());
+	explicit_memzero(&bytes[0], bytes.size());
+}
 
-	// Try looking up only the domain
-	std::string::size_type	at_sign_pos = sender_address.find('@');
-	if (at_sign_pos != std::string::npos) {
-		it = keys.find(sender_address.substr(at_sign_pos));
-		if (it != keys.end()) {
-			return !it->second.empty() ? &it->second : NULL;
+void	batv::derive_key (Key& out, const Key& master, String_view local_part, String_view domain)
+{
+	typedef crypto::Hmac<crypto::Sha256>	Hmac;
+
+	Hmac			hmac(master.get_hmac_sha256_key());
+	hmac.update(DERIVED_KEY_LABEL, sizeof(DERIVED_KEY_LABEL));	// including the NUL
+	hmac.update(local_part.data, local_part.size);
+	if (!domain.empty()) {
+		hmac.update("@", 1);
+		char		lowercase[64];
+		for (const char* p = domain.begin(); p != domain.end(); ) {
+			size_t	n = 0;
+			while (p != domain.end() && n < sizeof(lowercase)) {
+				lowercase[n++] = ascii_tolower(*p++);
+			}
+			hmac.update(lowercase, n);
 		}
 	}
 
-	return default_key;
-}
+	unsigned char		derived[Hmac::LENGTH];
+	hmac.finish(derived);
 
+	const unsigned int	num = master.get_num();
+	out.assign(derived, sizeof(derived));
+	out.set_num(num);
+	out.set_master(false);
+	explicit_memzero(derived, sizeof(derived));
+}
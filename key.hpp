@@ -31,22 +31,61 @@
 #ifndef BATV_KEY_HPP
 #define BATV_KEY_HPP
 
-#include <map>
+#include "hmac.hpp"
+#include "sha1.hpp"
+#include "sha256.hpp"
 #include <vector>
 #include <string>
-#include <iosfwd>
+#include <stddef.h>
+#include <stdint.h>
 
 namespace batv {
-	typedef std::vector<unsigned char> Key;
-	typedef std::map<std::string, Key> Key_map;
+	class Key {
+		std::vector<unsigned char>		bytes;
+		crypto::Hmac_key<crypto::Sha1>		hmac_key;	// HMAC midstates, computed once when the key is set
+		crypto::Hmac_key<crypto::Sha256>	hmac_sha256_key;
+		unsigned int				num;		// key-num (0-9) in the tags it signs, for key rollover
+		bool					master;		// derives a key for each address instead of signing (see derive_key)
+	public:
+		enum {
+			MAX_NUM = 9
+		};
+
+		Key () : num(0), master(false) { }
+		Key (const unsigned char* data, size_t len) : num(0), master(false) { assign(data, len); }
+
+		void					assign (const unsigned char* data, size_t len);
+		// Like assign, but with the HMAC midstates already computed (inner then
+		// outer; see crypto::Hmac_key::set_midstates), as in a compiled key map
+		void					assign (const unsigned char* data, size_t len,
+								const uint32_t* sha1_midstates, const uint32_t* sha256_midstates);
+		void					clear ();	// scrubs the key bytes, so a recycled Key doesn't hold on to them
+		bool					empty () const { return bytes.empty(); }
+		const std::vector<unsigned char>&	get_bytes () const { return bytes; }
+		const crypto::Hmac_key<crypto::Sha1>&	get_hmac_key () const { return hmac_key; }
+		const crypto::Hmac_key<crypto::Sha256>&	get_hmac_sha256_key () const { return hmac_sha256_key; }
+		unsigned int				get_num () const { return num; }
+		void					set_num (unsigned int arg_num) { num = arg_num; }
+		bool					is_master () const { return master; }
+		void					set_master (bool arg_master) { master = arg_master; }
+	};
 
 	void		load_key (Key& key, const std::string& key_file_path);
-	void		load_key_map (Key_map& key_map, std::istream& key_map_file_in);
 
-	// Get HMAC key for given sender from the key map:
-	//  returns default_key (which is NULL by default) if sender is not in map.
-	//  returns NULL if sender is in map with an empty key
-	const Key*	get_key (const Key_map&, const std::string& sender_address, const Key* default_key =NULL);
+	// A key map value is either the path to a key file or, if it starts
+	// with "hex:", the key itself in hex (at least MIN_INLINE_KEY_LENGTH bytes)
+	enum {
+		MIN_INLINE_KEY_LENGTH = 16
+	};
+	bool		is_inline_key_value (const std::string& value);
+	// NULL if an inline key value is well-formed, otherwise what's wrong with it (never the key itself)
+	const char*	inline_key_value_error (const std::string& value);
+	void		load_key_value (Key& key, const std::string& value);
+
+	// Set out to the key that master derives for local_part@domain: the
+	// HMAC-SHA-256, under master, of a label and the address with its domain
+	// lowercased.  It has master's key-num.  out may be the same as master.
+	void		derive_key (Key& out, const Key& master, String_view local_part, String_view domain);
 }
 
 #endif
@@ -0,0 +1,324 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "metrics.hpp"
+#include "common.hpp"
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <new>
+
+using namespace batv;
+
+namespace {
+	const size_t			CACHE_LINE_SIZE = 64;
+
+	// Upper bounds of the latency histogram buckets, in nanoseconds and as
+	// Prometheus "le" labels, in seconds.  There's also an implicit +Inf bucket.
+	const uint64_t			bucket_bounds[] = { 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000, 10000000, 50000000, 100000000, 500000000, 1000000000 };
+	const char* const		bucket_labels[] = { "1e-06", "5e-06", "1e-05", "5e-05", "0.0001", "0.0005", "0.001", "0.005", "0.01", "0.05", "0.1", "0.5", "1" };
+	const size_t			NUM_BUCKETS = sizeof(bucket_bounds) / sizeof(bucket_bounds[0]);
+
+	const char* const		callback_names[NUM_CALLBACKS] = { "negotiate", "connect", "envfrom", "envrcpt", "header", "eom", "abort", "close" };
+	const char* const		verify_result_names[] = { "none", "success", "missing", "bad_signature", "multiple_rcpt", "error" };
+
+	// One thread's metrics.  Only the thread that owns a shard writes to it,
+	// so it can increment with a plain load and store; they're atomic just so
+	// that a reader never sees a torn value.
+	struct Shard {
+		uint64_t		counters[NUM_COUNTERS];
+		uint64_t		buckets[NUM_CALLBACKS][NUM_BUCKETS + 1];	// non-cumulative; the last is +Inf
+		uint64_t		sum_ns[NUM_CALLBACKS];
+		Shard*			next;		// in all_shards
+		Shard*			next_free;	// in free_shards
+	};
+
+	// Shards are never freed, since their counts must survive their threads.
+	// When a thread exits, its shard is put on free_shards for the next new
+	// thread to take over.  (libmilter starts a thread for each connection.)
+	pthread_mutex_t			shards_mutex = PTHREAD_MUTEX_INITIALIZER;
+	Shard*				all_shards;
+	Shard*				free_shards;
+	pthread_key_t			shard_key;	// to be told when a thread exits
+	pthread_once_t			shard_key_once = PTHREAD_ONCE_INIT;
+	__thread Shard*			thread_shard;
+
+	void		release_shard (void* shard)
+	{
+		pthread_mutex_lock(&shards_mutex);
+		static_cast<Shard*>(shard)->next_free = free_shards;
+		free_shards = static_cast<Shard*>(shard);
+		pthread_mutex_unlock(&shards_mutex);
+	}
+
+	void		create_shard_key ()
+	{
+		pthread_key_create(&shard_key, release_shard);
+	}
+
+	Shard*		get_thread_shard ()
+	{
+		if (thread_shard) {
+			return thread_shard;
+		}
+
+		pthread_once(&shard_key_once, create_shard_key);
+
+		pthread_mutex_lock(&shards_mutex);
+		Shard*			shard = free_shards;
+		if (shard) {
+			free_shards = shard->next_free;
+		} else {
+			// Round the size up to a whole number of cache lines, so no two shards share one
+			void*		mem;
+			if (posix_memalign(&mem, CACHE_LINE_SIZE, (sizeof(Shard) + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE) == 0) {
+				shard = static_cast<Shard*>(mem);
+				std::memset(shard, '\0', sizeof(Shard));
+				shard->next = all_shards;
+				all_shards = shard;
+			}
+		}
+		pthread_mutex_unlock(&shards_mutex);
+
+		if (shard) {
+			pthread_setspecific(shard_key, shard);
+			thread_shard = shard;
+		}
+		return shard; // NULL if out of memory, in which case the metric is dropped
+	}
+
+	inline void	add (uint64_t* counter, uint64_t n)
+	{
+		__atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + n, __ATOMIC_RELAXED);
+	}
+
+	inline uint64_t	read (const uint64_t* counter)
+	{
+		return __atomic_load_n(counter, __ATOMIC_RELAXED);
+	}
+
+	void		sum_shards (Shard* total)
+	{
+		std::memset(total, '\0', sizeof(*total));
+		pthread_mutex_lock(&shards_mutex);
+		for (const Shard* shard = all_shards; shard; shard = shard->next) {
+			for (size_t i = 0; i < NUM_COUNTERS; ++i) {
+				total->counters[i] += read(&shard->counters[i]);
+			}
+			for (size_t c = 0; c < NUM_CALLBACKS; ++c) {
+				for (size_t b = 0; b <= NUM_BUCKETS; ++b) {
+					total->buckets[c][b] += read(&shard->buckets[c][b]);
+				}
+				total->sum_ns[c] += read(&shard->sum_ns[c]);
+			}
+		}
+		pthread_mutex_unlock(&shards_mutex);
+	}
+
+	void		write_counter (std::ostream& out, const char* name, const char* help, uint64_t value)
+	{
+		out << "# HELP " << name << ' ' << help << '\n';
+		out << "# TYPE " << name << " counter\n";
+		out << name << ' ' << value << '\n';
+	}
+
+	bool		write_all (int fd, const std::string& data)
+	{
+		for (size_t written = 0; written < data.size(); ) {
+			const ssize_t	n = write(fd, data.data() + written, data.size() - written);
+			if (n == -1) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			written += n;
+		}
+		return true;
+	}
+
+	void		serve_client (int listen_fd)
+	{
+		const int		client_fd = accept(listen_fd, NULL, NULL);
+		if (client_fd == -1) {
+			return;
+		}
+		// Don't let a client that doesn't read hold up the thread for long
+		struct timeval		timeout;
+		timeout.tv_sec = 5;
+		timeout.tv_usec = 0;
+		setsockopt(client_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		std::ostringstream	out;
+		write_metrics(out);
+		write_all(client_fd, out.str());
+		close(client_fd);
+	}
+
+	void		write_file (const std::string& path)
+	{
+		// Write a temporary file and rename it over path, so a reader never sees it half-written
+		const std::string	temp_path(path + ".tmp");
+		{
+			std::ofstream	out(temp_path.c_str());
+			write_metrics(out);
+			out.close();
+			if (!out) {
+				std::clog << temp_path << ": unable to write metrics" << std::endl;
+				std::remove(temp_path.c_str());
+				return;
+			}
+		}
+		if (std::rename(temp_path.c_str(), path.c_str()) == -1) {
+			std::clog << path << ": " << strerror(errno) << std::endl;
+			std::remove(temp_path.c_str());
+		}
+	}
+
+	struct Metrics_thread_args {
+		int			listen_fd;
+		std::string		file_path;
+		unsigned int		interval;
+	};
+
+	void*		metrics_thread_main (void* arg)
+	{
+		const Metrics_thread_args&	args(*static_cast<Metrics_thread_args*>(arg));
+		uint64_t			next_write = monotonic_nanoseconds();
+
+		for (;;) {
+			int			timeout = -1;
+			if (!args.file_path.empty()) {
+				const uint64_t	now = monotonic_nanoseconds();
+				if (now >= next_write) {
+					write_file(args.file_path);
+					next_write = now + args.interval * 1000000000ULL;
+				}
+				timeout = (next_write - now) / 1000000 + 1;
+			}
+
+			struct pollfd		pfd;
+			pfd.fd = args.listen_fd;	// poll ignores a negative fd
+			pfd.events = POLLIN;
+			pfd.revents = 0;
+			if (poll(&pfd, 1, timeout) == 1 && (pfd.revents & POLLIN)) {
+				serve_client(args.listen_fd);
+			}
+		}
+		return NULL;
+	}
+}
+
+void	batv::count_metric (Metric_counter counter, uint64_t n)
+{
+	if (Shard* shard = get_thread_shard()) {
+		add(&shard->counters[counter], n);
+	}
+}
+
+void	batv::record_callback_latency (Metric_callback callback, uint64_t nanoseconds)
+{
+	if (Shard* shard = get_thread_shard()) {
+		size_t		bucket = 0;
+		while (bucket < NUM_BUCKETS && nanoseconds > bucket_bounds[bucket]) {
+			++bucket;
+		}
+		add(&shard->buckets[callback][bucket], 1);
+		add(&shard->sum_ns[callback], nanoseconds);
+	}
+}
+
+uint64_t	batv::monotonic_nanoseconds ()
+{
+	struct timespec		ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+void	batv::write_metrics (std::ostream& out)
+{
+	Shard			total;
+	sum_shards(&total);
+
+	out << "# HELP batv_milter_connections_total SMTP connections, by whether the client is an internal host (unchecked in verify-only mode).\n";
+	out << "# TYPE batv_milter_connections_total counter\n";
+	out << "batv_milter_connections_total{client=\"internal\"} " << total.counters[COUNTER_CONNECTIONS_INTERNAL] << '\n';
+	out << "batv_milter_connections_total{client=\"external\"} " << total.counters[COUNTER_CONNECTIONS_EXTERNAL] << '\n';
+	out << "batv_milter_connections_total{client=\"unchecked\"} " << total.counters[COUNTER_CONNECTIONS_UNCHECKED] << '\n';
+
+	write_counter(out, "batv_milter_messages_total", "Messages that reached end-of-message.", total.counters[COUNTER_MESSAGES]);
+	write_counter(out, "batv_milter_signatures_total", "Envelope senders signed.", total.counters[COUNTER_SIGNATURES]);
+	write_counter(out, "batv_milter_rcpt_rejected_total", "Recipients refused at RCPT TO.", total.counters[COUNTER_RCPT_REJECTED]);
+
+	out << "# HELP batv_milter_verify_results_total Outcomes of verifying envelope recipients.\n";
+	out << "# TYPE batv_milter_verify_results_total counter\n";
+	for (size_t i = 0; i <= VERIFY_ERROR; ++i) {
+		out << "batv_milter_verify_results_total{result=\"" << verify_result_names[i] << "\"} " << total.counters[COUNTER_VERIFY_NONE + i] << '\n';
+	}
+
+	out << "# HELP batv_milter_callback_duration_seconds Time spent in each milter callback.\n";
+	out << "# TYPE batv_milter_callback_duration_seconds histogram\n";
+	for (size_t c = 0; c < NUM_CALLBACKS; ++c) {
+		uint64_t	count = 0;
+		for (size_t b = 0; b <= NUM_BUCKETS; ++b) {
+			count += total.buckets[c][b];
+			out << "batv_milter_callback_duration_seconds_bucket{callback=\"" << callback_names[c] << "\",le=\"" << (b < NUM_BUCKETS ? bucket_labels[b] : "+Inf") << "\"} " << count << '\n';
+		}
+		char		sum[32];
+		std::snprintf(sum, sizeof(sum), "%llu.%09llu", static_cast<unsigned long long>(total.sum_ns[c] / 1000000000), static_cast<unsigned long long>(total.sum_ns[c] % 1000000000));
+		out << "batv_milter_callback_duration_seconds_sum{callback=\"" << callback_names[c] << "\"} " << sum << '\n';
+		out << "batv_milter_callback_duration_seconds_count{callback=\"" << callback_names[c] << "\"} " << count << '\n';
+	}
+}
+
+void	batv::start_metrics_thread (int listen_fd, const std::string& file_path, unsigned int interval)
+{
+	Metrics_thread_args*	args = new Metrics_thread_args;	// owned by the thread, which runs until exit
+	args->listen_fd = listen_fd;
+	args->file_path = file_path;
+	args->interval = interval;
+
+	pthread_t		thread;
+	if (int err = pthread_create(&thread, NULL, metrics_thread_main, args)) {
+		delete args;
+		throw Initialization_error(std::string("Unable to start metrics thread: ") + strerror(err));
+	}
+	pthread_detach(thread);
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef BATV_METRICS_HPP
+#define BATV_METRICS_HPP
+
+#include "verify.hpp"
+#include <string>
+#include <iosfwd>
+#include <stdint.h>
+
+namespace batv {
+	// Runtime counters and callback latency histograms for batv-milter.
+	// Each thread updates a cache-line-aligned shard of its own, with plain
+	// stores and no locking; the shards are only summed when the metrics are
+	// read (see write_metrics).
+
+	enum Metric_counter {
+		COUNTER_CONNECTIONS_INTERNAL,	// connections from internal hosts
+		COUNTER_CONNECTIONS_EXTERNAL,	// other connections
+		COUNTER_CONNECTIONS_UNCHECKED,	// connections whose client wasn't checked (on_connect skipped)
+		COUNTER_MESSAGES,		// messages that reached end-of-message
+		COUNTER_SIGNATURES,		// envelope senders signed
+		COUNTER_RCPT_REJECTED,		// recipients refused at RCPT TO
+		COUNTER_VERIFY_NONE,		// verification outcomes, in Verify_result order
+		COUNTER_VERIFY_SUCCESS,
+		COUNTER_VERIFY_MISSING,
+		COUNTER_VERIFY_BAD_SIGNATURE,
+		COUNTER_VERIFY_MULTIPLE_RCPT,
+		COUNTER_VERIFY_ERROR,
+		NUM_COUNTERS
+	};
+
+	enum Metric_callback {
+		CALLBACK_NEGOTIATE,
+		CALLBACK_CONNECT,
+		CALLBACK_ENVFROM,
+		CALLBACK_ENVRCPT,
+		CALLBACK_HEADER,
+		CALLBACK_EOM,
+		CALLBACK_ABORT,
+		CALLBACK_CLOSE,
+		NUM_CALLBACKS
+	};
+
+	void		count_metric (Metric_counter, uint64_t n =1);
+	inline void	count_verify_result (Verify_result result) { count_metric(static_cast<Metric_counter>(COUNTER_VERIFY_NONE + result)); }
+	void		record_callback_latency (Metric_callback, uint64_t nanoseconds);
+	uint64_t	monotonic_nanoseconds ();
+
+	// Records the time from its construction to its destruction as the latency of a callback
+	class Callback_timer {
+		Metric_callback	callback;
+		uint64_t	start;
+
+		Callback_timer (const Callback_timer&);
+		Callback_timer& operator= (const Callback_timer&);
+	public:
+		explicit Callback_timer (Metric_callback arg_callback) : callback(arg_callback), start(monotonic_nanoseconds()) { }
+		~Callback_timer () { record_callback_latency(callback, monotonic_nanoseconds() - start); }
+	};
+
+	// Write the metrics, summed over all threads, in the Prometheus text exposition format
+	void		write_metrics (std::ostream&);
+
+	// Serve the metrics from a background thread: to every client that connects
+	// to listen_fd (a listening UNIX domain socket, or -1 for none), and by
+	// rewriting file_path (unless empty) every interval seconds
+	void		start_metrics_thread (int listen_fd, const std::string& file_path, unsigned int interval);
+}
+
+#endif
@@ -32,12 +32,14 @@
 #include <vector>
 #include <algorithm>
 #include <stdint.h>
-#include <cstdio>
-#include <stdio.h>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 #include "hmac.hpp"
 #include "sha1.hpp"
+#include "sha1-multi.hpp"
+#include "sha256.hpp"
+#include "util.hpp"
 
 using namespace batv;
 
@@ -46,20 +48,130 @@ static unsigned int today ()
 	return (std::time(NULL) / 86400) % 1000;
 }
 
-static void make_prvs_hash (unsigned char* hash_out, const char* tag_val, const Email_address& orig_mailfrom, const std::vector<unsigned char>& key)
+namespace {
+	// tag-val includes only the first bytes of the HMAC: 3 for prvs, as in the
+	// BATV draft, and 8 for prvs-sha256, so that it's harder to forge, too
+	enum {
+		PRVS_HASH_LENGTH = 3,
+		PRVS_SHA256_HASH_LENGTH = 8
+	};
+}
+
+namespace {
+	// The hash-source is public, so its message schedule needn't be scrubbed,
+	// but the states derived from the key's midstates still are.  (The
+	// midstates themselves come from crypto::Sha1, which scrubs everything.)
+	typedef crypto::Block_hash<crypto::Basic_sha1_state<crypto::Scrub_on_destruction> >	Message_sha1;
+	typedef crypto::Block_hash<crypto::Basic_sha256_state<crypto::Scrub_on_destruction> >	Message_sha256;
+}
+
+namespace {
+	// tag-val codec.  This is done by hand rather than with sscanf/snprintf
+	// since it's on the hot path, and sscanf is lenient about what it
+	// accepts (leading whitespace, signs, short fields).
+
+	// Returns the value of hex digit c (either case), or 16 if c isn't one
+	inline unsigned int	decode_hex_digit (unsigned char c)
+	{
+		const unsigned int	digit = c - static_cast<unsigned int>('0');
+		const unsigned int	letter = (c | 0x20) - static_cast<unsigned int>('a');
+		return digit < 10 ? digit : letter < 6 ? letter + 10 : 16;
+	}
+
+	// Decode tag-val = K DDD SSSSSS (with HASH_LENGTH bytes of S).  Returns false if it is malformed.
+	template<size_t HASH_LENGTH> bool decode_tag_val (const char* tag_val, unsigned int* key_num, unsigned int* day, unsigned char* hash)
+	{
+		const unsigned char*	p = reinterpret_cast<const unsigned char*>(tag_val);
+		unsigned int		digits[4];
+		unsigned int		nibbles[HASH_LENGTH * 2];
+		unsigned int		invalid = 0;
+
+		for (size_t i = 0; i < 4; ++i) {
+			digits[i] = p[i] - static_cast<unsigned int>('0');
+			invalid |= digits[i] > 9;
+		}
+		for (size_t i = 0; i < HASH_LENGTH * 2; ++i) {
+			nibbles[i] = decode_hex_digit(p[4 + i]);
+			invalid |= nibbles[i] > 15;
+		}
+
+		*key_num = digits[0];
+		*day = digits[1] * 100 + digits[2] * 10 + digits[3];
+		for (size_t i = 0; i < HASH_LENGTH; ++i) {
+			hash[i] = (nibbles[2 * i] << 4) | nibbles[2 * i + 1];
+		}
+		return !invalid;
+	}
+
+	// Encode the K DDD part of tag-val
+	void		encode_tag_prefix (char* tag_val, unsigned int key_num, unsigned int day)
+	{
+		tag_val[0] = '0' + key_num;
+		tag_val[1] = '0' + day / 100;
+		tag_val[2] = '0' + day / 10 % 10;
+		tag_val[3] = '0' + day % 10;
+	}
+
+	// Encode the SSSSSS part of tag-val
+	template<size_t HASH_LENGTH> void encode_tag_hash (char* tag_val, const unsigned char* hash)
+	{
+		static const char	hex_digits[] = "0123456789abcdef";
+
+		for (size_t i = 0; i < HASH_LENGTH; ++i) {
+			tag_val[4 + 2 * i] = hex_digits[hash[i] >> 4];
+			tag_val[5 + 2 * i] = hex_digits[hash[i] & 0x0F];
+		}
+	}
+
+	// Constant-time comparison of two HMACs
+	template<size_t HASH_LENGTH> bool hash_equals (const unsigned char* a, const unsigned char* b)
+	{
+		unsigned int	diff = 0;
+		for (size_t i = 0; i < HASH_LENGTH; ++i) {
+			diff |= a[i] ^ b[i];
+		}
+		return diff == 0;
+	}
+}
+
+template<size_t HASH_LENGTH, class Message_hash, class Key_hash> static void make_prvs_hash (unsigned char* hash_out, const char* tag_val, const char* local_part, size_t local_part_len, const char* domain, size_t domain_len, const crypto::Hmac_key<Key_hash>& key)
+{
+	typedef crypto::Hmac<Message_hash>	Hmac;
+
+	// hash-source = K DDD <orig-mailfrom>
+	const size_t			len = 4 + local_part_len + 1 + domain_len;
+
+	if (len <= Hmac::MAX_SHORT_LENGTH) {
+		// Nearly all addresses are short enough for this
+		unsigned char		block[Message_hash::BLOCK_LENGTH];
+		std::memcpy(block, tag_val, 4);
+		std::memcpy(block + 4, local_part, local_part_len);
+		block[4 + local_part_len] = '@';
+		std::memcpy(block + 4 + local_part_len + 1, domain, domain_len);
+		Hmac::template compute_short<HASH_LENGTH>(hash_out, key, block, len);
+	} else {
+		Hmac			hmac(key);
+		hmac.update(tag_val, 4);
+		hmac.update(local_part, local_part_len);
+		hmac.update("@", 1);
+		hmac.update(domain, domain_len);
+		hmac.finish(hash_out, HASH_LENGTH);
+	}
+}
+
+// Append the address's hash-source to out
+static void append_hash_source (std::string& out, const Batv_address_view& address)
 {
 	// hash-source = K DDD <orig-mailfrom>
-	crypto::Hmac<crypto::Sha1>	hmac(key.data(), key.size());
-	hmac.update(tag_val, 4);
-	hmac.update(orig_mailfrom.local_part.data(), orig_mailfrom.local_part.size());
-	hmac.update("@", 1);
-	hmac.update(orig_mailfrom.domain.data(), orig_mailfrom.domain.size());
-	hmac.finish(hash_out);
+	out.append(address.tag_val.data, 4);
+	out.append(address.orig_mailfrom.local_part.data, address.orig_mailfrom.local_part.size).append(1, '@');
+	out.append(address.orig_mailfrom.domain.data, address.orig_mailfrom.domain.size);
 }
 
-bool	batv::prvs_validate (const Batv_address& address, unsigned int lifetime, const std::vector<unsigned char>& key)
+// Check everything about the tag except the HMAC, and decode the claimed HMAC
+template<size_t HASH_LENGTH> static bool check_tag (const char* tag_val, size_t tag_val_len, unsigned int lifetime, unsigned int expected_key_num, unsigned char* claimed_hmac)
 {
-	if (address.tag_val.size() != 10) {
+	if (tag_val_len != 4 + HASH_LENGTH * 2) {
 		return false;
 	}
 
@@ -67,12 +179,13 @@ bool	batv::prvs_validate (const Batv_address& address, unsigned int lifetime, co
 
 	unsigned int			key_num;
 	unsigned int			expiration_day;
-	unsigned int			claimed_hmac[3];
 
-	std::sscanf(address.tag_val.c_str(), "%1u%3u%2x%2x%2x", &key_num, &expiration_day, &claimed_hmac[0], &claimed_hmac[1], &claimed_hmac[2]);
+	if (!decode_tag_val<HASH_LENGTH>(tag_val, &key_num, &expiration_day, claimed_hmac)) {
+		return false;
+	}
 
-	// check the key-num
-	if (key_num != 0) {
+	// check the key-num (the caller looked up the key by it, but the sender may not have that key)
+	if (key_num != expected_key_num) {
 		return false;
 	}
 
@@ -81,38 +194,180 @@ bool	batv::prvs_validate (const Batv_address& address, unsigned int lifetime, co
 		return false;
 	}
 
+	return true;
+}
+
+template<size_t HASH_LENGTH, class Message_hash, class Key_hash> static bool validate_tag (const char* tag_val, size_t tag_val_len,
+									 const char* local_part, size_t local_part_len,
+									 const char* domain, size_t domain_len,
+									 unsigned int lifetime, const crypto::Hmac_key<Key_hash>& key, unsigned int key_num)
+{
+	unsigned char			claimed_hmac[HASH_LENGTH];
+	if (!check_tag<HASH_LENGTH>(tag_val, tag_val_len, lifetime, key_num, claimed_hmac)) {
+		return false;
+	}
+
 	// validate the HMAC
-	unsigned char			correct_hmac[20];
-	make_prvs_hash(correct_hmac, &address.tag_val[0], address.orig_mailfrom, key);
+	unsigned char			correct_hmac[HASH_LENGTH];
+	make_prvs_hash<HASH_LENGTH, Message_hash>(correct_hmac, tag_val, local_part, local_part_len, domain, domain_len, key);
 
-	return ((claimed_hmac[0] ^ correct_hmac[0]) |
-		(claimed_hmac[1] ^ correct_hmac[1]) |
-		(claimed_hmac[2] ^ correct_hmac[2])) == 0;
+	return hash_equals<HASH_LENGTH>(claimed_hmac, correct_hmac);
 }
 
-Batv_address	batv::prvs_generate (const Email_address& orig_mailfrom, unsigned int lifetime, const std::vector<unsigned char>& key)
+template<size_t HASH_LENGTH, class Message_hash, class Key_hash> static void generate_tag (char* tag_val_out,
+									const char* local_part, size_t local_part_len,
+									const char* domain, size_t domain_len,
+									unsigned int lifetime, const crypto::Hmac_key<Key_hash>& key, unsigned int key_num)
 {
 	// tag-val        =  K DDD SSSSSS
-	char				val[11];
-	
-	// key-num
-	val[0] = '0';
+	encode_tag_prefix(tag_val_out, key_num, (today() + lifetime) % 1000);
 
-	// expiration
-	snprintf(val + 1, 4, "%03u", (today() + lifetime) % 1000);
+	unsigned char			hmac[HASH_LENGTH];
+	make_prvs_hash<HASH_LENGTH, Message_hash>(hmac, tag_val_out, local_part, local_part_len, domain, domain_len, key);
+	encode_tag_hash<HASH_LENGTH>(tag_val_out, hmac);
+}
 
-	// HMAC
-	unsigned char			hmac[20];
-	make_prvs_hash(hmac, val, orig_mailfrom, key);
+bool	batv::prvs_validate_tag (const char* tag_val, size_t tag_val_len,
+				 const char* local_part, size_t local_part_len,
+				 const char* domain, size_t domain_len,
+				 unsigned int lifetime, const Key& key)
+{
+	return validate_tag<PRVS_HASH_LENGTH, Message_sha1>(tag_val, tag_val_len, local_part, local_part_len, domain, domain_len, lifetime, key.get_hmac_key(), key.get_num());
+}
 
-	snprintf(val + 4, 7, "%02x%02x%02x", static_cast<unsigned int>(hmac[0]),
-						static_cast<unsigned int>(hmac[1]),
-						static_cast<unsigned int>(hmac[2]));
+bool	batv::prvs_sha256_validate_tag (const char* tag_val, size_t tag_val_len,
+					const char* local_part, size_t local_part_len,
+					const char* domain, size_t domain_len,
+					unsigned int lifetime, const Key& key)
+{
+	return validate_tag<PRVS_SHA256_HASH_LENGTH, Message_sha256>(tag_val, tag_val_len, local_part, local_part_len, domain, domain_len, lifetime, key.get_hmac_sha256_key(), key.get_num());
+}
+
+bool	batv::prvs_validate (const Batv_address_view& address, unsigned int lifetime, const Key& key)
+{
+	return prvs_validate_tag(address.tag_val.data, address.tag_val.size,
+				 address.orig_mailfrom.local_part.data, address.orig_mailfrom.local_part.size,
+				 address.orig_mailfrom.domain.data, address.orig_mailfrom.domain.size,
+				 lifetime, key);
+}
+
+std::vector<bool>	batv::prvs_validate_many (const Batv_address_view* addresses, const Key* const* keys, size_t count, unsigned int lifetime)
+{
+	typedef crypto::Sha1_multi	Sha1_multi;
+	typedef crypto::Sha1_state	Sha1_state;
+
+	std::vector<bool>		results(count, false);
+
+	// Multi-buffer hashing doesn't beat a compression function with hardware
+	// support (SHA-NI, or libcrypto's, which uses it where it can), and is
+	// slower than scalar hashing unless there are enough addresses to fill the lanes
+	const Sha1_state::Implementation	implementation = Sha1_state::get_implementation();
+	if (implementation == Sha1_state::IMPL_SHANI || implementation == Sha1_state::IMPL_OPENSSL || count < Sha1_multi::lanes()) {
+		for (size_t i = 0; i < count; ++i) {
+			results[i] = prvs_validate(addresses[i], lifetime, *keys[i]);
+		}
+		return results;
+	}
+
+	std::vector<size_t>		pending;		// addresses whose tag checks out, pending HMAC validation
+	std::vector<unsigned char>	claimed_hmacs;		// PRVS_HASH_LENGTH per pending address
+	std::string			hash_sources;		// the pending addresses' hash-sources, concatenated...
+	std::vector<size_t>		source_offsets;		// ...starting at these offsets (plus one for the end)
+
+	for (size_t i = 0; i < count; ++i) {
+		unsigned char		claimed_hmac[PRVS_HASH_LENGTH];
+		if (!check_tag<PRVS_HASH_LENGTH>(addresses[i].tag_val.data, addresses[i].tag_val.size, lifetime, keys[i]->get_num(), claimed_hmac)) {
+			continue;
+		}
+		pending.push_back(i);
+		claimed_hmacs.insert(claimed_hmacs.end(), claimed_hmac, claimed_hmac + PRVS_HASH_LENGTH);
+		source_offsets.push_back(hash_sources.size());
+		append_hash_source(hash_sources, addresses[i]);
+	}
+	source_offsets.push_back(hash_sources.size());
+
+	if (pending.size() < Sha1_multi::lanes()) {
+		// Too few left to fill the lanes
+		for (size_t j = 0; j < pending.size(); ++j) {
+			results[pending[j]] = prvs_validate(addresses[pending[j]], lifetime, *keys[pending[j]]);
+		}
+		return results;
+	}
+
+	// Inner hashes, starting from each key's ipad midstate
+	std::vector<size_t>		offsets(pending.size());	// of each pending address's padded hash-source in buffer
+	size_t				buffer_size = 0;
+	for (size_t j = 0; j < pending.size(); ++j) {
+		offsets[j] = buffer_size;
+		buffer_size += Sha1_multi::padded_length(source_offsets[j + 1] - source_offsets[j]);
+	}
+	std::vector<unsigned char>	buffer(buffer_size);
+	std::vector<Sha1_multi::Job>	jobs(pending.size());
+	for (size_t j = 0; j < pending.size(); ++j) {
+		const crypto::Sha1&		inner(keys[pending[j]]->get_hmac_key().get_inner());
+
+		std::copy(inner.get_state().get_words(), inner.get_state().get_words() + 5, jobs[j].state);
+		jobs[j].data = &buffer[offsets[j]];
+		jobs[j].num_blocks = Sha1_multi::pad(&buffer[offsets[j]], hash_sources.data() + source_offsets[j], source_offsets[j + 1] - source_offsets[j], inner.get_count());
+	}
+	Sha1_multi::compute(&jobs[0], jobs.size());
+
+	// Outer hashes, starting from each key's opad midstate
+	std::vector<unsigned char>	digests(pending.size() * Sha1_multi::BLOCK_LENGTH);
+	for (size_t j = 0; j < pending.size(); ++j) {
+		const crypto::Sha1&		outer(keys[pending[j]]->get_hmac_key().get_outer());
+		unsigned char			digest[Sha1_multi::LENGTH];
+
+		Sha1_multi::write(jobs[j].state, digest);
+		std::copy(outer.get_state().get_words(), outer.get_state().get_words() + 5, jobs[j].state);
+		jobs[j].data = &digests[j * Sha1_multi::BLOCK_LENGTH];
+		jobs[j].num_blocks = Sha1_multi::pad(&digests[j * Sha1_multi::BLOCK_LENGTH], digest, sizeof(digest), outer.get_count());
+		explicit_memzero(digest, sizeof(digest));
+	}
+	Sha1_multi::compute(&jobs[0], jobs.size());
+
+	for (size_t j = 0; j < pending.size(); ++j) {
+		unsigned char			correct_hmac[PRVS_HASH_LENGTH];
+		Sha1_multi::write(jobs[j].state, correct_hmac, sizeof(correct_hmac));
+		results[pending[j]] = hash_equals<PRVS_HASH_LENGTH>(&claimed_hmacs[j * PRVS_HASH_LENGTH], correct_hmac);
+	}
+
+	explicit_memzero(&digests[0], digests.size());
+	explicit_memzero(&jobs[0], jobs.size() * sizeof(jobs[0]));
+	return results;
+}
+
+void	batv::prvs_generate_tag (char* tag_val_out,
+				 const char* local_part, size_t local_part_len,
+				 const char* domain, size_t domain_len,
+				 unsigned int lifetime, const Key& key)
+{
+	generate_tag<PRVS_HASH_LENGTH, Message_sha1>(tag_val_out, local_part, local_part_len, domain, domain_len, lifetime, key.get_hmac_key(), key.get_num());
+}
+
+void	batv::prvs_sha256_generate_tag (char* tag_val_out,
+					const char* local_part, size_t local_part_len,
+					const char* domain, size_t domain_len,
+					unsigned int lifetime, const Key& key)
+{
+	generate_tag<PRVS_SHA256_HASH_LENGTH, Message_sha256>(tag_val_out, local_part, local_part_len, domain, domain_len, lifetime, key.get_hmac_sha256_key(), key.get_num());
+}
+
+int	batv::prvs_tag_key_num (const char* tag_val, size_t tag_val_len)
+{
+	return tag_val_len > 0 && tag_val[0] >= '0' && tag_val[0] <= '9' ? tag_val[0] - '0' : -1;
+}
+
+Batv_address	batv::prvs_generate (const Email_address& orig_mailfrom, unsigned int lifetime, const Key& key)
+{
+	char				val[PRVS_TAG_VAL_LENGTH];
+	prvs_generate_tag(val, orig_mailfrom.local_part.data(), orig_mailfrom.local_part.size(),
+			  orig_mailfrom.domain.data(), orig_mailfrom.domain.size(),
+			  lifetime, key);
 
 	Batv_address	address;
 	address.tag_type = "prvs";
-	address.tag_val.assign(val, val + 10);
+	address.tag_val.assign(val, val + PRVS_TAG_VAL_LENGTH);
 	address.orig_mailfrom = orig_mailfrom;
 	return address;
 }
-
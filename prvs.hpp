@@ -32,12 +32,58 @@
 #define BATV_PRVS_HPP
 
 #include "address.hpp"
-#include <vector>
+#include "key.hpp"
 #include <string>
+#include <vector>
+#include <stddef.h>
 
 namespace batv {
-	bool		prvs_validate (const Batv_address&, unsigned int lifetime, const std::vector<unsigned char>& key);
-	Batv_address	prvs_generate (const Email_address& orig_mailfrom, unsigned int lifetime, const std::vector<unsigned char>& key);
+	bool		prvs_validate (const Batv_address_view&, unsigned int lifetime, const Key& key);
+
+	// The key-num in generated tags is key.get_num(), and a tag only
+	// validates with a key whose number matches its key-num.
+
+	// Validate count addresses at once, where keys[i] is the key for addresses[i].
+	// The HMACs are computed in parallel with Sha1_multi, unless the SHA-1
+	// compression function has hardware support or there are fewer addresses
+	// than lanes, when they're computed one by one.  Element i of the result
+	// is the same as prvs_validate(addresses[i], lifetime, *keys[i]).
+	std::vector<bool> prvs_validate_many (const Batv_address_view* addresses, const Key* const* keys, size_t count, unsigned int lifetime);
+
+	Batv_address	prvs_generate (const Email_address& orig_mailfrom, unsigned int lifetime, const Key& key);
+
+	// Allocation-free versions of prvs_validate and prvs_generate, for callers
+	// that already have the parts of the address in buffers of their own.
+	// The original mailfrom is passed as its local part and domain.
+	enum {
+		PRVS_TAG_VAL_LENGTH = 10,		// K DDD SSSSSS
+		PRVS_SHA256_TAG_VAL_LENGTH = 20		// K DDD SSSSSSSSSSSSSSSS
+	};
+	bool		prvs_validate_tag (const char* tag_val, size_t tag_val_len,
+					   const char* local_part, size_t local_part_len,
+					   const char* domain, size_t domain_len,
+					   unsigned int lifetime, const Key& key);
+
+	// Writes exactly PRVS_TAG_VAL_LENGTH characters (no NUL terminator) to tag_val_out
+	void		prvs_generate_tag (char* tag_val_out,
+					   const char* local_part, size_t local_part_len,
+					   const char* domain, size_t domain_len,
+					   unsigned int lifetime, const Key& key);
+
+	// The key-num (K) of a prvs or prvs-sha256 tag-val, which says which of
+	// the sender's keys signed it, or -1 if it doesn't have one
+	int		prvs_tag_key_num (const char* tag_val, size_t tag_val_len);
+
+	// prvs-sha256: like prvs, but with HMAC-SHA-256 in place of HMAC-SHA-1, and
+	// 8 bytes of it in the tag-val instead of 3 (PRVS_SHA256_TAG_VAL_LENGTH characters)
+	bool		prvs_sha256_validate_tag (const char* tag_val, size_t tag_val_len,
+						  const char* local_part, size_t local_part_len,
+						  const char* domain, size_t domain_len,
+						  unsigned int lifetime, const Key& key);
+	void		prvs_sha256_generate_tag (char* tag_val_out,
+						  const char* local_part, size_t local_part_len,
+						  const char* domain, size_t domain_len,
+						  unsigned int lifetime, const Key& key);
 }
 
 #endif
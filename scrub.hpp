@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2026 Andrew Ayer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization.
+ */
+
+#ifndef BATV_SCRUB_HPP
+#define BATV_SCRUB_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace crypto {
+	// Zeroization policies for hash states (Basic_sha1_state, and through it
+	// Block_hash and Hmac).  on_transform: zero the message schedule that the
+	// compression function derives from each block.  working_variables: zero
+	// the compression function's working variables, which together with the
+	// block are enough to recover the starting state.  on_destruction: zero
+	// the hash state and buffered input when the object is destroyed.
+
+	// For hashing secret input, such as key material.  This is the default.
+	struct Scrub_always {
+		static const bool	on_transform = true;
+		static const bool	working_variables = true;
+		static const bool	on_destruction = true;
+	};
+
+	// For a secret starting state (e.g. an HMAC midstate) but public input.
+	// The message schedule depends only on the input, so it needn't be zeroed.
+	struct Scrub_on_destruction {
+		static const bool	on_transform = false;
+		static const bool	working_variables = true;
+		static const bool	on_destruction = true;
+	};
+
+	// For hashing public data only, starting from the public initial state.
+	struct Scrub_never {
+		static const bool	on_transform = false;
+		static const bool	working_variables = false;
+		static const bool	on_destruction = false;
+	};
+
+	// Zero a compression function's working variables in a way that can't be
+	// optimized away: plain stores, then a single empty asm that claims to use them
+	inline void scrub_words (uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d, uint32_t& e)
+	{
+		a = b = c = d = e = 0;
+#if defined(__GNUC__)
+		__asm__ __volatile__ ("" : "+m" (a), "+m" (b), "+m" (c), "+m" (d), "+m" (e));
+#else
+		volatile uint32_t*	words[] = { &a, &b, &c, &d, &e };
+		for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i) {
+			*words[i] = 0;
+		}
+#endif
+	}
+
+	inline void scrub_words (uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d, uint32_t& e, uint32_t& f, uint32_t& g, uint32_t& h)
+	{
+		a = b = c = d = e = f = g = h = 0;
+#if defined(__GNUC__)
+		__asm__ __volatile__ ("" : "+m" (a), "+m" (b), "+m" (c), "+m" (d), "+m" (e), "+m" (f), "+m" (g), "+m" (h));
+#else
+		volatile uint32_t*	words[] = { &a, &b, &c, &d, &e, &f, &g, &h };
+		for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); ++i) {
+			*words[i] = 0;
+		}
+#endif
+	}
+}
+
+#endif
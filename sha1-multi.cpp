@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2026 Andrew Ayer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization.
+ */
+
+#include "sha1-multi.hpp"
+#include "sha1-x86.hpp"
+#include "util.hpp"
+#include <cstring>
+
+using namespace crypto;
+
+/*
+ * The lane code is written once, in terms of GCC vector types, and
+ * instantiated for each vector width.  run_lanes() and transform_lanes()
+ * are forced inline, so they are compiled for the ISA of the run_lanes_*()
+ * wrapper that uses them.  (Vectors are never passed by value, since
+ * that's ABI-dependent on the ISA.)
+ */
+
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__((always_inline))
+typedef uint32_t Vec4 __attribute__((vector_size(16)));
+typedef uint32_t Vec8 __attribute__((vector_size(32)));
+typedef uint32_t Vec16 __attribute__((vector_size(64)));
+#else
+#define ALWAYS_INLINE inline
+typedef uint32_t Vec4;
+#endif
+
+namespace {
+	inline uint32_t	load_be32 (const unsigned char* p)
+	{
+		return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+		       (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+	}
+
+#define ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+#define BLK(i) (blocks[(i)&15])
+#define EXPAND(i) (BLK(i) = ROL(BLK((i)+13) ^ BLK((i)+8) ^ BLK((i)+2) ^ BLK(i), 1))
+
+#define DO_ROUND(i, constant, function) \
+	do { \
+		e += (function) + (i < 16 ? BLK(i) : EXPAND(i)) + constant + ROL(a, 5); \
+		b = ROL(b, 30); \
+		t = e; e = d; d = c; c = b; b = a; a = t; \
+	} while (0)
+
+	// The same rounds as Sha1_state::transform, one lane per message
+	template<class Vec> ALWAYS_INLINE void	transform_lanes (Vec* state, Vec* blocks)
+	{
+		Vec	a = state[0];
+		Vec	b = state[1];
+		Vec	c = state[2];
+		Vec	d = state[3];
+		Vec	e = state[4];
+		Vec	t;
+
+		for (int i =  0; i < 20; ++i) DO_ROUND(i, 0x5A827999, ((b&(c^d))^d));
+		for (int i = 20; i < 40; ++i) DO_ROUND(i, 0x6ED9EBA1, (b^c^d));
+		for (int i = 40; i < 60; ++i) DO_ROUND(i, 0x8F1BBCDC, (((b|c)&d)|(b&c)));
+		for (int i = 60; i < 80; ++i) DO_ROUND(i, 0xCA62C1D6, (b^c^d));
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+
+	template<class Vec, unsigned int N> ALWAYS_INLINE void	run_lanes (Sha1_multi::Job* jobs, size_t num_jobs)
+	{
+		union {
+			Vec		vec[5];
+			uint32_t	word[5][N];
+		}			state;
+		union {
+			Vec		vec[16];
+			uint32_t	word[16][N];
+		}			blocks;
+		Sha1_multi::Job*	lane_job[N];
+		size_t			lane_block[N];	// index of next block to hash in each lane
+		size_t			next_job = 0;
+
+		// Idle lanes hash whatever is in them, so make that zeros rather than indeterminate
+		std::memset(&state, 0, sizeof(state));
+		std::memset(&blocks, 0, sizeof(blocks));
+
+		for (unsigned int lane = 0; lane < N; ++lane) {
+			lane_job[lane] = NULL;
+			lane_block[lane] = 0;
+		}
+
+		while (true) {
+			// Refill idle lanes.  Lanes left idle at the end hash stale data, which is discarded.
+			bool		active = false;
+			for (unsigned int lane = 0; lane < N; ++lane) {
+				while (!lane_job[lane] && next_job < num_jobs) {
+					if (jobs[next_job].num_blocks > 0) {
+						lane_job[lane] = &jobs[next_job];
+						lane_block[lane] = 0;
+					}
+					++next_job;
+				}
+				active |= lane_job[lane] != NULL;
+			}
+			if (!active) {
+				break;
+			}
+
+			for (unsigned int lane = 0; lane < N; ++lane) {
+				if (const Sha1_multi::Job* job = lane_job[lane]) {
+					const unsigned char*	p = job->data + lane_block[lane] * Sha1_multi::BLOCK_LENGTH;
+					for (unsigned int i = 0; i < 5; ++i) {
+						state.word[i][lane] = job->state[i];
+					}
+					for (unsigned int i = 0; i < 16; ++i) {
+						blocks.word[i][lane] = load_be32(p + i * 4);
+					}
+				}
+			}
+
+			transform_lanes(state.vec, blocks.vec);
+
+			for (unsigned int lane = 0; lane < N; ++lane) {
+				if (Sha1_multi::Job* job = lane_job[lane]) {
+					for (unsigned int i = 0; i < 5; ++i) {
+						job->state[i] = state.word[i][lane];
+					}
+					if (++lane_block[lane] == job->num_blocks) {
+						lane_job[lane] = NULL;
+					}
+				}
+			}
+		}
+
+		explicit_memzero(&state, sizeof(state));
+		explicit_memzero(&blocks, sizeof(blocks));
+	}
+
+	void run_lanes_default (Sha1_multi::Job* jobs, size_t num_jobs)
+	{
+		run_lanes<Vec4, sizeof(Vec4) / 4>(jobs, num_jobs);
+	}
+
+#ifdef BATV_SHA1_X86
+	__attribute__((target("avx2")))
+	void run_lanes_avx2 (Sha1_multi::Job* jobs, size_t num_jobs)
+	{
+		run_lanes<Vec8, 8>(jobs, num_jobs);
+	}
+
+	__attribute__((target("avx512f")))
+	void run_lanes_avx512 (Sha1_multi::Job* jobs, size_t num_jobs)
+	{
+		run_lanes<Vec16, 16>(jobs, num_jobs);
+	}
+#endif
+}
+
+namespace {
+	typedef void (*Run_function) (Sha1_multi::Job*, size_t);
+
+	// The lane code for a number of lanes, or NULL if this CPU doesn't support it
+	Run_function	run_function_for (unsigned int lanes)
+	{
+		switch (lanes) {
+#ifdef BATV_SHA1_X86
+		case 16:
+			return sha1_x86::have_avx512() ? run_lanes_avx512 : NULL;
+		case 8:
+			return sha1_x86::have_avx2() ? run_lanes_avx2 : NULL;
+#endif
+		case sizeof(Vec4) / 4:
+			return run_lanes_default;
+		default:
+			return NULL;
+		}
+	}
+
+	unsigned int	best_lanes ()
+	{
+#ifdef BATV_SHA1_X86
+		if (sha1_x86::have_avx512()) {
+			return 16;
+		}
+		if (sha1_x86::have_avx2()) {
+			return 8;
+		}
+#endif
+		return sizeof(Vec4) / 4;
+	}
+
+	// Selected during static initialization, before any threads are started
+	unsigned int	current_lanes = best_lanes();
+	Run_function	current_run = run_function_for(current_lanes);
+}
+
+unsigned int Sha1_multi::lanes ()
+{
+	return current_lanes;
+}
+
+bool Sha1_multi::set_lanes (unsigned int lanes)
+{
+	Run_function	run = run_function_for(lanes);
+	if (!run) {
+		return false;
+	}
+	current_lanes = lanes;
+	current_run = run;
+	return true;
+}
+
+void Sha1_multi::compute (Job* jobs, size_t num_jobs)
+{
+	current_run(jobs, num_jobs);
+}
+
+void Sha1_multi::init (uint32_t* state)
+{
+	state[0] = 0x67452301;
+	state[1] = 0xEFCDAB89;
+	state[2] = 0x98BADCFE;
+	state[3] = 0x10325476;
+	state[4] = 0xC3D2E1F0;
+}
+
+size_t Sha1_multi::pad (unsigned char* out, const void* data, size_t len, unsigned long long prefix_len)
+{
+	const size_t	total_len = padded_length(len);
+
+	std::memcpy(out, data, len);
+	out[len] = 0x80;
+	std::memset(out + len + 1, 0, total_len - len - 9);
+	store_be64(out + total_len - 8, (prefix_len + len) << 3);
+	return total_len / BLOCK_LENGTH;
+}
+
+void Sha1_multi::write (const uint32_t* state, unsigned char* out, size_t out_len)
+{
+	for (unsigned int i = 0; i < out_len && i < LENGTH; ++i) {
+		out[i] = (state[i / 4] >> ((3 - (i % 4)) * 8)) & 0xFF;
+	}
+}
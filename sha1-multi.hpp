@@ -0,0 +1,76 @@
+/*
+ * Copyright (C) 2026 Andrew Ayer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization.
+ */
+
+#ifndef BATV_SHA1_MULTI_HPP
+#define BATV_SHA1_MULTI_HPP
+
+#include "sha1.hpp"
+#include <stdint.h>
+#include <stddef.h>
+
+namespace crypto {
+	// Multi-buffer SHA-1: hashes many independent messages at once, one
+	// message per SIMD lane (16 lanes with AVX-512, 8 with AVX2, otherwise 4,
+	// or just 1 without GCC vector extensions).
+	// Worthwhile when there are lots of short messages, such as BATV tags.
+	class Sha1_multi {
+	public:
+		enum {
+			LENGTH = Sha1_state::LENGTH,
+			BLOCK_LENGTH = Sha1_state::BLOCK_LENGTH,
+			MAX_LANES = 16U
+		};
+
+		// One message, occupying one lane while it is being hashed
+		struct Job {
+			uint32_t		state[5];	// chaining value on input, hash state on output
+			const unsigned char*	data;		// the message's blocks, including padding
+			size_t			num_blocks;
+		};
+
+		static unsigned int	lanes ();	// number of lanes used on this CPU
+		static bool		set_lanes (unsigned int); // returns false if unsupported by this CPU
+
+		// Run the jobs to completion.  Jobs needn't be the same length;
+		// as soon as a lane's job finishes the lane is refilled.
+		static void		compute (Job* jobs, size_t num_jobs);
+
+		// Helpers for setting up and finishing jobs:
+		static void		init (uint32_t* state);	// set state to the SHA-1 initial value
+		static size_t		padded_length (size_t len) { return ((len + 8) / BLOCK_LENGTH + 1) * BLOCK_LENGTH; }
+
+		// Copy data to out (which must have room for padded_length(len) bytes)
+		// and append the SHA-1 padding.  prefix_len is the number of bytes
+		// already hashed into the job's chaining value (a multiple of 64).
+		// Returns the number of blocks.
+		static size_t		pad (unsigned char* out, const void* data, size_t len, unsigned long long prefix_len =0);
+
+		static void		write (const uint32_t* state, unsigned char* out, size_t out_len =LENGTH);
+	};
+}
+
+#endif
@@ -0,0 +1,278 @@
+/*
+ * Copyright (C) 2026 Andrew Ayer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization.
+ */
+
+#include "sha1-x86.hpp"
+
+#ifdef BATV_SHA1_X86
+
+#include "scrub.hpp"
+#include "util.hpp"
+#include <cpuid.h>
+#include <immintrin.h>
+
+using namespace crypto;
+
+namespace {
+	struct Cpu_features {
+		bool		ssse3;
+		bool		sse41;
+		bool		sha;
+		bool		avx2;
+		bool		avx512;
+
+		Cpu_features ()
+		{
+			unsigned int	eax, ebx, ecx, edx;
+			bool		os_ymm = false;	// OS saves YMM registers on context switch
+			bool		os_zmm = false;	// OS saves ZMM registers on context switch
+
+			ssse3 = sse41 = sha = avx2 = avx512 = false;
+			if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+				ssse3 = ecx & bit_SSSE3;
+				sse41 = ecx & bit_SSE4_1;
+				if (ecx & bit_OSXSAVE) {
+					unsigned int	xcr0_lo, xcr0_hi;
+					__asm__ ("xgetbv" : "=a" (xcr0_lo), "=d" (xcr0_hi) : "c" (0));
+					os_ymm = (xcr0_lo & 0x06) == 0x06;
+					os_zmm = (xcr0_lo & 0xE6) == 0xE6;
+				}
+			}
+			if (__get_cpuid_max(0, NULL) >= 7) {
+				__cpuid_count(7, 0, eax, ebx, ecx, edx);
+				sha = ebx & bit_SHA;
+				avx2 = os_ymm && (ebx & bit_AVX2);
+				avx512 = os_zmm && (ebx & bit_AVX512F);
+			}
+		}
+	};
+
+	const Cpu_features&	cpu_features ()
+	{
+		static const Cpu_features	features;
+		return features;
+	}
+}
+
+bool sha1_x86::have_ssse3 ()
+{
+	return cpu_features().ssse3;
+}
+
+bool sha1_x86::have_shani ()
+{
+	return cpu_features().sha && cpu_features().ssse3 && cpu_features().sse41;
+}
+
+bool sha1_x86::have_avx2 ()
+{
+	return cpu_features().avx2;
+}
+
+bool sha1_x86::have_avx512 ()
+{
+	return cpu_features().avx512;
+}
+
+/*
+ * SSSE3: the message schedule is computed four words at a time (with the
+ * constants pre-added), and the rounds themselves are done in scalar code.
+ * Based on the technique described in "Improving the Performance of the
+ * Secure Hash Algorithm (SHA-1)" by Max Locktyukhin (Intel, 2010):
+ *
+ *  W[16..31] use the standard recurrence, patching up the last lane of each
+ *  vector since it depends on the first lane of the same vector.
+ *
+ *  W[32..79] use the equivalent recurrence
+ *   W[i] = (W[i-6] ^ W[i-16] ^ W[i-28] ^ W[i-32]) rol 2
+ *  which has no dependencies within a vector.
+ */
+
+#define ROL(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+#define F1(x, y, z) (((x)&((y)^(z)))^(z))
+#define F2(x, y, z) ((x)^(y)^(z))
+#define F3(x, y, z) ((((x)|(y))&(z))|((x)&(y)))
+#define F4(x, y, z) ((x)^(y)^(z))
+
+#define ROUND(v, w, x, y, z, i, function) \
+	do { \
+		z += function(w, x, y) + wk[i] + ROL(v, 5); \
+		w = ROL(w, 30); \
+	} while (0)
+
+#define ROUNDS5(i, function) \
+	do { \
+		ROUND(a,b,c,d,e,(i)+0,function); ROUND(e,a,b,c,d,(i)+1,function); \
+		ROUND(d,e,a,b,c,(i)+2,function); ROUND(c,d,e,a,b,(i)+3,function); \
+		ROUND(b,c,d,e,a,(i)+4,function); \
+	} while (0)
+
+namespace {
+	__attribute__((target("ssse3")))
+	inline __m128i	rol_epi32 (__m128i x, int bits)
+	{
+		return _mm_or_si128(_mm_slli_epi32(x, bits), _mm_srli_epi32(x, 32 - bits));
+	}
+}
+
+template<bool SCRUB_SCHEDULE, bool SCRUB_WORKING> __attribute__((target("ssse3")))
+void sha1_x86::transform_ssse3 (uint32_t* state, const unsigned char* block)
+{
+	const __m128i	bswap = _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+	const __m128i	k[4] = {
+		_mm_set1_epi32(0x5A827999),
+		_mm_set1_epi32(0x6ED9EBA1),
+		_mm_set1_epi32(0x8F1BBCDC),
+		_mm_set1_epi32(0xCA62C1D6)
+	};
+	__m128i		w[20];
+	uint32_t	wk[80];
+	uint32_t	a, b, c, d, e;
+
+	for (int i = 0; i < 4; ++i) {
+		w[i] = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + i * 16)), bswap);
+	}
+	for (int i = 4; i < 8; ++i) {
+		__m128i	t = _mm_xor_si128(_mm_xor_si128(w[i-4], _mm_alignr_epi8(w[i-3], w[i-4], 8)),
+					  _mm_xor_si128(w[i-2], _mm_srli_si128(w[i-1], 4)));
+		// Lane 3 is missing the W[i] term, which is lane 0 rotated by 1
+		w[i] = _mm_xor_si128(rol_epi32(t, 1), rol_epi32(_mm_slli_si128(t, 12), 2));
+	}
+	for (int i = 8; i < 20; ++i) {
+		w[i] = rol_epi32(_mm_xor_si128(_mm_xor_si128(w[i-8], w[i-7]),
+					       _mm_xor_si128(_mm_alignr_epi8(w[i-1], w[i-2], 8), w[i-4])), 2);
+	}
+	for (int i = 0; i < 20; ++i) {
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(wk + i * 4), _mm_add_epi32(w[i], k[i / 5]));
+	}
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+
+	ROUNDS5( 0, F1); ROUNDS5( 5, F1); ROUNDS5(10, F1); ROUNDS5(15, F1);
+	ROUNDS5(20, F2); ROUNDS5(25, F2); ROUNDS5(30, F2); ROUNDS5(35, F2);
+	ROUNDS5(40, F3); ROUNDS5(45, F3); ROUNDS5(50, F3); ROUNDS5(55, F3);
+	ROUNDS5(60, F4); ROUNDS5(65, F4); ROUNDS5(70, F4); ROUNDS5(75, F4);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+
+	if (SCRUB_WORKING) {
+		scrub_words(a, b, c, d, e);
+	}
+	if (SCRUB_SCHEDULE) {
+		explicit_memzero(w, sizeof(w));
+		explicit_memzero(wk, sizeof(wk));
+	}
+}
+
+template void sha1_x86::transform_ssse3<true, true> (uint32_t*, const unsigned char*);
+template void sha1_x86::transform_ssse3<false, true> (uint32_t*, const unsigned char*);
+template void sha1_x86::transform_ssse3<false, false> (uint32_t*, const unsigned char*);
+
+/*
+ * SHA-NI: four rounds per SHA1RNDS4, with SHA1MSG1/SHA1MSG2 doing the
+ * message schedule.  ABCD is held in one register (A in the high lane)
+ * and E is carried in the high lane of a second register.
+ */
+
+// Rounds 4g..4g+3.  e_in holds E for these rounds; e_out receives the
+// ABCD value from which E for the next four rounds is derived.
+#define RNDS4(e_in, e_out, msg, function) \
+	do { \
+		e_in = _mm_sha1nexte_epu32(e_in, msg); \
+		e_out = abcd; \
+		abcd = _mm_sha1rnds4_epu32(abcd, e_in, function); \
+	} while (0)
+
+// W[4g+16..4g+19] from W[4g..4g+15]
+#define SCHEDULE(m0, m1, m2, m3) \
+	(m0 = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(m0, m1), m2), m3))
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha1_x86::transform_shani (uint32_t* state, const unsigned char* block)
+{
+	const __m128i	bswap = _mm_set_epi8(0,1,2,3, 4,5,6,7, 8,9,10,11, 12,13,14,15);
+	__m128i		abcd, abcd_save, e0, e0_save, e1;
+	__m128i		m0, m1, m2, m3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+	e0 = _mm_set_epi32(state[4], 0, 0, 0);
+	abcd_save = abcd;
+	e0_save = e0;
+
+	m0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block +  0)), bswap);
+	m1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16)), bswap);
+	m2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 32)), bswap);
+	m3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 48)), bswap);
+
+	/* Rounds 0-3 (E is added directly since there is no previous ABCD) */
+	e0 = _mm_add_epi32(e0, m0);
+	e1 = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+
+	/* Rounds 4-19 */
+	RNDS4(e1, e0, m1, 0);
+	RNDS4(e0, e1, m2, 0);
+	RNDS4(e1, e0, m3, 0);
+	SCHEDULE(m0, m1, m2, m3); RNDS4(e0, e1, m0, 0);
+
+	/* Rounds 20-39 */
+	SCHEDULE(m1, m2, m3, m0); RNDS4(e1, e0, m1, 1);
+	SCHEDULE(m2, m3, m0, m1); RNDS4(e0, e1, m2, 1);
+	SCHEDULE(m3, m0, m1, m2); RNDS4(e1, e0, m3, 1);
+	SCHEDULE(m0, m1, m2, m3); RNDS4(e0, e1, m0, 1);
+	SCHEDULE(m1, m2, m3, m0); RNDS4(e1, e0, m1, 1);
+
+	/* Rounds 40-59 */
+	SCHEDULE(m2, m3, m0, m1); RNDS4(e0, e1, m2, 2);
+	SCHEDULE(m3, m0, m1, m2); RNDS4(e1, e0, m3, 2);
+	SCHEDULE(m0, m1, m2, m3); RNDS4(e0, e1, m0, 2);
+	SCHEDULE(m1, m2, m3, m0); RNDS4(e1, e0, m1, 2);
+	SCHEDULE(m2, m3, m0, m1); RNDS4(e0, e1, m2, 2);
+
+	/* Rounds 60-79 */
+	SCHEDULE(m3, m0, m1, m2); RNDS4(e1, e0, m3, 3);
+	SCHEDULE(m0, m1, m2, m3); RNDS4(e0, e1, m0, 3);
+	SCHEDULE(m1, m2, m3, m0); RNDS4(e1, e0, m1, 3);
+	SCHEDULE(m2, m3, m0, m1); RNDS4(e0, e1, m2, 3);
+	SCHEDULE(m3, m0, m1, m2); RNDS4(e1, e0, m3, 3);
+
+	e0 = _mm_sha1nexte_epu32(e0, e0_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 Andrew Ayer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization.
+ */
+
+#ifndef BATV_SHA1_X86_HPP
+#define BATV_SHA1_X86_HPP
+
+#include <stdint.h>
+
+// SIMD implementations of the SHA-1 compression function for x86.  These
+// are compiled with per-function target attributes, so no special compiler
+// flags are needed and the binary still runs on CPUs that lack them.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BATV_SHA1_X86 1
+
+namespace crypto {
+	namespace sha1_x86 {
+		bool	have_ssse3 ();
+		bool	have_shani ();
+		bool	have_avx2 ();
+		bool	have_avx512 ();
+
+		template<bool SCRUB_SCHEDULE, bool SCRUB_WORKING> __attribute__((target("ssse3")))
+		void	transform_ssse3 (uint32_t* state, const unsigned char* block);
+		void	transform_shani (uint32_t* state, const unsigned char* block);
+	}
+}
+#endif
+
+#endif
@@ -29,22 +29,41 @@
 #define BATV_SHA1_HPP
 
 #include "blockhash.hpp"
+#include "scrub.hpp"
 #include "util.hpp"
 #include <stdint.h>
 #include <stddef.h>
+#include <cstring>
 
 namespace crypto {
-	class Sha1_state {
+	// The parts of the SHA-1 state that don't depend on the zeroization policy
+	class Sha1_base {
 	public:
 		enum {
 			LENGTH = 20U,
-			BLOCK_LENGTH = 64U
+			BLOCK_LENGTH = 64U,
+			STATE_WORDS = 5
 		};
 
-		Sha1_state ();
-		~Sha1_state ();
-		void transform (const unsigned char*);
-		void write (unsigned char* out, size_t out_len =LENGTH);
+		// Compression function backends, chosen once at startup based on CPUID
+		// (falling back to libcrypto's instead of IMPL_GENERIC, if built with CRYPTO=openssl)
+		enum Implementation {
+			IMPL_GENERIC,		// portable C++
+			IMPL_SSSE3,		// SSSE3 message schedule, scalar rounds (only if selected explicitly)
+			IMPL_SHANI,		// x86 SHA extensions
+			IMPL_OPENSSL		// libcrypto's SHA1_Transform
+		};
+
+		static Implementation	get_implementation ();
+		static bool		set_implementation (Implementation); // returns false if unsupported by this CPU
+		static const char*	implementation_name (Implementation);
+
+		// The compression function.  Afterwards the message schedule is zeroed if SCRUB_SCHEDULE
+		// is true, and the working variables if SCRUB_WORKING is (see scrub.hpp).
+		template<bool SCRUB_SCHEDULE, bool SCRUB_WORKING> static void compress (uint32_t* state, const unsigned char* block);
+
+		static void init_state (uint32_t* state);
+		static void write_state (const uint32_t* state, unsigned char* out, size_t out_len);
 
 		template<class Hash> static void pad (Hash& hash)
 		{
@@ -57,10 +76,53 @@ namespace crypto {
 			hash.update(length_pad, 8);		// Append 8 byte length, which should form complete block
 		}
 
+		// Pad a message of len bytes (len <= BLOCK_LENGTH - 9) in place so it forms
+		// the final block.  total_len counts all bytes hashed, including this block's.
+		static void pad_block (unsigned char* block, size_t len, unsigned long long total_len)
+		{
+			block[len] = 0x80;
+			std::memset(block + len + 1, 0, BLOCK_LENGTH - 8 - (len + 1));
+			store_be64(block + BLOCK_LENGTH - 8, total_len << 3);
+		}
+	};
+
+	// (Scrubbing the schedule but not the working variables isn't supported)
+	template<> void Sha1_base::compress<true, true> (uint32_t*, const unsigned char*);
+	template<> void Sha1_base::compress<false, true> (uint32_t*, const unsigned char*);
+	template<> void Sha1_base::compress<false, false> (uint32_t*, const unsigned char*);
+
+	// Scrub is a zeroization policy from scrub.hpp
+	template<class Scrub> class Basic_sha1_state : public Sha1_base {
+	public:
+		typedef Scrub		Scrub_policy;
+
+		Basic_sha1_state () { init_state(state); }
+		template<class Other_scrub> explicit Basic_sha1_state (const Basic_sha1_state<Other_scrub>& other)
+		{
+			std::memcpy(state, other.get_words(), sizeof(state));
+		}
+		~Basic_sha1_state ()
+		{
+			if (Scrub::on_destruction) {
+				explicit_memzero(state, sizeof(state));
+			}
+		}
+
+		void transform (const unsigned char* block) { compress<Scrub::on_transform, Scrub::working_variables>(state, block); }
+		void write (unsigned char* out, size_t out_len =LENGTH) const
+		{
+			if (out) {
+				write_state(state, out, out_len);
+			}
+		}
+		const uint32_t* get_words () const { return state; } // the chaining value, for Sha1_multi
+		void set_words (const uint32_t* words) { std::memcpy(state, words, sizeof(state)); }
+
 	private:
 		uint32_t	state[5];
 	};
 
+	typedef Basic_sha1_state<Scrub_always> Sha1_state;
 	typedef Block_hash<Sha1_state> Sha1;
 }
 
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2026 Andrew Ayer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization.
+ */
+
+#include "sha256-x86.hpp"
+
+#ifdef BATV_SHA256_X86
+
+#include <immintrin.h>
+
+using namespace crypto;
+
+namespace {
+	const uint32_t	k[64] = {
+		0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+		0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+		0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+		0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+		0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+		0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+		0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+		0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+	};
+}
+
+/*
+ * SHA-NI: each SHA256RNDS2 does two rounds, taking the state split into
+ * ABEF and CDGH registers.  SHA256MSG1/SHA256MSG2 (plus a PALIGNR and an
+ * add for the W[i-7] term) compute the message schedule four words at a time.
+ */
+
+// Rounds 4g..4g+3, with m holding W[4g..4g+3]
+#define RNDS4(g, m) \
+	do { \
+		msg = _mm_add_epi32(m, _mm_loadu_si128(reinterpret_cast<const __m128i*>(k + 4 * (g)))); \
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg); \
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg, 0x0E)); \
+	} while (0)
+
+// W[4g+16..4g+19] from W[4g..4g+15]
+#define SCHEDULE(m0, m1, m2, m3) \
+	(m0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(m0, m1), _mm_alignr_epi8(m3, m2, 4)), m3))
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha256_x86::transform_shani (uint32_t* state, const unsigned char* block)
+{
+	const __m128i	bswap = _mm_set_epi8(12,13,14,15, 8,9,10,11, 4,5,6,7, 0,1,2,3);
+	__m128i		abef, cdgh, abef_save, cdgh_save, tmp, msg;
+	__m128i		m0, m1, m2, m3;
+
+	// Rearrange ABCD EFGH into ABEF CDGH
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);	// CDAB
+	cdgh = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);	// EFGH
+	abef = _mm_alignr_epi8(tmp, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, tmp, 0xF0);
+	abef_save = abef;
+	cdgh_save = cdgh;
+
+	m0 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block +  0)), bswap);
+	m1 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 16)), bswap);
+	m2 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 32)), bswap);
+	m3 = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 48)), bswap);
+
+	/* Rounds 0-15 */
+	RNDS4( 0, m0);
+	RNDS4( 1, m1);
+	RNDS4( 2, m2);
+	RNDS4( 3, m3);
+
+	/* Rounds 16-63 */
+	SCHEDULE(m0, m1, m2, m3); RNDS4( 4, m0);
+	SCHEDULE(m1, m2, m3, m0); RNDS4( 5, m1);
+	SCHEDULE(m2, m3, m0, m1); RNDS4( 6, m2);
+	SCHEDULE(m3, m0, m1, m2); RNDS4( 7, m3);
+	SCHEDULE(m0, m1, m2, m3); RNDS4( 8, m0);
+	SCHEDULE(m1, m2, m3, m0); RNDS4( 9, m1);
+	SCHEDULE(m2, m3, m0, m1); RNDS4(10, m2);
+	SCHEDULE(m3, m0, m1, m2); RNDS4(11, m3);
+	SCHEDULE(m0, m1, m2, m3); RNDS4(12, m0);
+	SCHEDULE(m1, m2, m3, m0); RNDS4(13, m1);
+	SCHEDULE(m2, m3, m0, m1); RNDS4(14, m2);
+	SCHEDULE(m3, m0, m1, m2); RNDS4(15, m3);
+
+	abef = _mm_add_epi32(abef, abef_save);
+	cdgh = _mm_add_epi32(cdgh, cdgh_save);
+
+	// Back to ABCD EFGH
+	tmp = _mm_shuffle_epi32(abef, 0x1B);	// FEBA
+	cdgh = _mm_shuffle_epi32(cdgh, 0xB1);	// DCHG
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state), _mm_blend_epi16(tmp, cdgh, 0xF0));		// DCBA
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), _mm_alignr_epi8(cdgh, tmp, 8));	// HGFE
+}
+
+#endif
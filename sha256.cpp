@@ -0,0 +1,261 @@
+/*
+ * Copyright (C) 2026 Andrew Ayer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization.
+ */
+
+#include "sha256.hpp"
+#include "sha256-x86.hpp"
+#include "util.hpp"
+#include <stdint.h>
+#ifdef BATV_CRYPTO_OPENSSL
+#define OPENSSL_SUPPRESS_DEPRECATED	// SHA256_Transform is deprecated in OpenSSL 3, but it's the only
+					// libcrypto interface which lets us keep our own midstates
+#include <openssl/sha.h>
+#endif
+
+using namespace crypto;
+
+void Sha256_base::init_state (uint32_t* state)
+{
+	state[0] = 0x6A09E667;
+	state[1] = 0xBB67AE85;
+	state[2] = 0x3C6EF372;
+	state[3] = 0xA54FF53A;
+	state[4] = 0x510E527F;
+	state[5] = 0x9B05688C;
+	state[6] = 0x1F83D9AB;
+	state[7] = 0x5BE0CD19;
+}
+
+namespace {
+	const uint32_t	k[64] = {
+		0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+		0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+		0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+		0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+		0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+		0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+		0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+		0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2
+	};
+}
+
+#define LOAD_BE32(p) ((((const unsigned char *)(p))[0] << 24) | \
+		      (((const unsigned char *)(p))[1] << 16) | \
+		      (((const unsigned char *)(p))[2] <<  8) | \
+		      (((const unsigned char *)(p))[3] <<  0) )
+
+#define ROR(value, bits) (((value) >> (bits)) | ((value) << (32 - (bits))))
+
+#define CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+#define SIGMA0(x)	(ROR(x, 2) ^ ROR(x, 13) ^ ROR(x, 22))
+#define SIGMA1(x)	(ROR(x, 6) ^ ROR(x, 11) ^ ROR(x, 25))
+#define GAMMA0(x)	(ROR(x, 7) ^ ROR(x, 18) ^ ((x) >> 3))
+#define GAMMA1(x)	(ROR(x, 17) ^ ROR(x, 19) ^ ((x) >> 10))
+
+// The message schedule is kept in a rolling window of 16 words
+#define W(i) (w[(i)&15])
+#define SRC_BLOCK(i) (W(i) = LOAD_BE32(buffer + (i)*4))
+#define SRC_SCHEDULE(i) (W(i) += GAMMA1(W((i)+14)) + W((i)+9) + GAMMA0(W((i)+1)))
+
+#define ROUND(a, b, c, d, e, f, g, h, i, source) \
+	do { \
+		uint32_t t1 = h + SIGMA1(e) + CH(e, f, g) + k[i] + source(i); \
+		d += t1; \
+		h = t1 + SIGMA0(a) + MAJ(a, b, c); \
+	} while (0)
+
+#define ROUNDS8(i, source) \
+	do { \
+		ROUND(a,b,c,d,e,f,g,h,(i)+0,source); ROUND(h,a,b,c,d,e,f,g,(i)+1,source); \
+		ROUND(g,h,a,b,c,d,e,f,(i)+2,source); ROUND(f,g,h,a,b,c,d,e,(i)+3,source); \
+		ROUND(e,f,g,h,a,b,c,d,(i)+4,source); ROUND(d,e,f,g,h,a,b,c,(i)+5,source); \
+		ROUND(c,d,e,f,g,h,a,b,(i)+6,source); ROUND(b,c,d,e,f,g,h,a,(i)+7,source); \
+	} while (0)
+
+template<bool SCRUB_SCHEDULE, bool SCRUB_WORKING> static void transform_generic (uint32_t* state, const unsigned char* buffer)
+{
+	uint32_t a, b, c, d, e, f, g, h;
+	uint32_t w[16];
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+	e = state[4];
+	f = state[5];
+	g = state[6];
+	h = state[7];
+
+	ROUNDS8( 0, SRC_BLOCK);    ROUNDS8( 8, SRC_BLOCK);
+	ROUNDS8(16, SRC_SCHEDULE); ROUNDS8(24, SRC_SCHEDULE);
+	ROUNDS8(32, SRC_SCHEDULE); ROUNDS8(40, SRC_SCHEDULE);
+	ROUNDS8(48, SRC_SCHEDULE); ROUNDS8(56, SRC_SCHEDULE);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+
+	if (SCRUB_WORKING) {
+		scrub_words(a, b, c, d, e, f, g, h);
+	}
+	if (SCRUB_SCHEDULE) {
+		explicit_memzero(w, sizeof(w));
+	}
+}
+
+#ifdef BATV_CRYPTO_OPENSSL
+template<bool SCRUB_WORKING> static void transform_openssl (uint32_t* state, const unsigned char* buffer)
+{
+	SHA256_CTX	ctx;
+
+	for (size_t i = 0; i < 8; ++i) {
+		ctx.h[i] = state[i];
+	}
+	SHA256_Transform(&ctx, buffer);
+	for (size_t i = 0; i < 8; ++i) {
+		state[i] = ctx.h[i];
+	}
+
+	if (SCRUB_WORKING) {
+		explicit_memzero(&ctx, sizeof(ctx));
+	}
+}
+#endif
+
+namespace {
+	typedef void (*Transform_function) (uint32_t*, const unsigned char*);
+
+	// A compression function, for each zeroization policy in scrub.hpp
+	struct Transform_functions {
+		Transform_function	scrub;		// schedule and working variables
+		Transform_function	scrub_working;	// working variables only
+		Transform_function	no_scrub;
+	};
+
+	Sha256_base::Implementation	best_implementation ()
+	{
+#ifdef BATV_SHA256_X86
+		if (sha256_x86::have_shani()) {
+			return Sha256_base::IMPL_SHANI;
+		}
+#endif
+#ifdef BATV_CRYPTO_OPENSSL
+		// As with SHA-1, libcrypto only stands in for the portable implementation
+		return Sha256_base::IMPL_OPENSSL;
+#else
+		return Sha256_base::IMPL_GENERIC;
+#endif
+	}
+
+	Transform_functions		transform_functions_for (Sha256_base::Implementation impl)
+	{
+		Transform_functions	funcs = { NULL, NULL, NULL };
+
+		switch (impl) {
+#ifdef BATV_SHA256_X86
+		case Sha256_base::IMPL_SHANI:
+			// Everything stays in registers; there are no temporaries to scrub
+			if (sha256_x86::have_shani()) {
+				funcs.scrub = funcs.scrub_working = funcs.no_scrub = sha256_x86::transform_shani;
+			}
+			break;
+#endif
+#ifdef BATV_CRYPTO_OPENSSL
+		case Sha256_base::IMPL_OPENSSL:
+			// SHA256_CTX holds the new state, so it's scrubbed unless the state is public
+			funcs.scrub = funcs.scrub_working = transform_openssl<true>;
+			funcs.no_scrub = transform_openssl<false>;
+			break;
+#endif
+		case Sha256_base::IMPL_GENERIC:
+			funcs.scrub = transform_generic<true, true>;
+			funcs.scrub_working = transform_generic<false, true>;
+			funcs.no_scrub = transform_generic<false, false>;
+			break;
+		default:
+			break;
+		}
+		return funcs;
+	}
+
+	// Selected during static initialization, before any threads are started
+	Sha256_base::Implementation	current_implementation = best_implementation();
+	Transform_functions		current_transform = transform_functions_for(current_implementation);
+}
+
+Sha256_base::Implementation Sha256_base::get_implementation ()
+{
+	return current_implementation;
+}
+
+bool Sha256_base::set_implementation (Implementation impl)
+{
+	Transform_functions	funcs = transform_functions_for(impl);
+	if (!funcs.scrub) {
+		return false;
+	}
+	current_implementation = impl;
+	current_transform = funcs;
+	return true;
+}
+
+const char* Sha256_base::implementation_name (Implementation impl)
+{
+	switch (impl) {
+	case IMPL_GENERIC:	return "generic";
+	case IMPL_SHANI:	return "sha-ni";
+	case IMPL_OPENSSL:	return "openssl";
+	}
+	return "unknown";
+}
+
+template<> void Sha256_base::compress<true, true> (uint32_t* state, const unsigned char* block)
+{
+	current_transform.scrub(state, block);
+}
+
+template<> void Sha256_base::compress<false, true> (uint32_t* state, const unsigned char* block)
+{
+	current_transform.scrub_working(state, block);
+}
+
+template<> void Sha256_base::compress<false, false> (uint32_t* state, const unsigned char* block)
+{
+	current_transform.no_scrub(state, block);
+}
+
+void Sha256_base::write_state (const uint32_t* state, unsigned char* out, size_t out_len)
+{
+	for (unsigned int i = 0; i < out_len && i < LENGTH; ++i) {
+		out[i] = (state[i / 4] >> ((3 - (i % 4)) * 8)) & 0xFF;
+	}
+}
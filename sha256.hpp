@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2026 Andrew Ayer
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * Except as contained in this notice, the name(s) of the above copyright
+ * holders shall not be used in advertising or otherwise to promote the
+ * sale, use or other dealings in this Software without prior written
+ * authorization.
+ */
+
+#ifndef BATV_SHA256_HPP
+#define BATV_SHA256_HPP
+
+#include "blockhash.hpp"
+#include "scrub.hpp"
+#include "util.hpp"
+#include <stdint.h>
+#include <stddef.h>
+#include <cstring>
+
+namespace crypto {
+	// The parts of the SHA-256 state that don't depend on the zeroization policy
+	class Sha256_base {
+	public:
+		enum {
+			LENGTH = 32U,
+			BLOCK_LENGTH = 64U,
+			STATE_WORDS = 8
+		};
+
+		// Compression function backends, chosen once at startup based on CPUID
+		// (falling back to libcrypto's instead of IMPL_GENERIC, if built with CRYPTO=openssl)
+		enum Implementation {
+			IMPL_GENERIC,		// portable C++
+			IMPL_SHANI,		// x86 SHA extensions
+			IMPL_OPENSSL		// libcrypto's SHA256_Transform
+		};
+
+		static Implementation	get_implementation ();
+		static bool		set_implementation (Implementation); // returns false if unsupported by this CPU
+		static const char*	implementation_name (Implementation);
+
+		// The compression function.  Afterwards the message schedule is zeroed if SCRUB_SCHEDULE
+		// is true, and the working variables if SCRUB_WORKING is (see scrub.hpp).
+		template<bool SCRUB_SCHEDULE, bool SCRUB_WORKING> static void compress (uint32_t* state, const unsigned char* block);
+
+		static void init_state (uint32_t* state);
+		static void write_state (const uint32_t* state, unsigned char* out, size_t out_len);
+
+		// SHA-256 pads exactly like SHA-1
+		template<class Hash> static void pad (Hash& hash)
+		{
+			unsigned char		length_pad[8];
+			store_be64(length_pad, hash.get_count() << 3);
+			hash.update("\200", 1);			// Append 0x80
+			while (hash.get_count() % 64 != 56) {	// Append zeros until current block is 56 bytes long
+				hash.update("\0", 1);
+			}
+			hash.update(length_pad, 8);		// Append 8 byte length, which should form complete block
+		}
+
+		// Pad a message of len bytes (len <= BLOCK_LENGTH - 9) in place so it forms
+		// the final block.  total_len counts all bytes hashed, including this block's.
+		static void pad_block (unsigned char* block, size_t len, unsigned long long total_len)
+		{
+			block[len] = 0x80;
+			std::memset(block + len + 1, 0, BLOCK_LENGTH - 8 - (len + 1));
+			store_be64(block + BLOCK_LENGTH - 8, total_len << 3);
+		}
+	};
+
+	// (Scrubbing the schedule but not the working variables isn't supported)
+	template<> void Sha256_base::compress<true, true> (uint32_t*, const unsigned char*);
+	template<> void Sha256_base::compress<false, true> (uint32_t*, const unsigned char*);
+	template<> void Sha256_base::compress<false, false> (uint32_t*, const unsigned char*);
+
+	// Scrub is a zeroization policy from scrub.hpp
+	template<class Scrub> class Basic_sha256_state : public Sha256_base {
+	public:
+		typedef Scrub		Scrub_policy;
+
+		Basic_sha256_state () { init_state(state); }
+		template<class Other_scrub> explicit Basic_sha256_state (const Basic_sha256_state<Other_scrub>& other)
+		{
+			std::memcpy(state, other.get_words(), sizeof(state));
+		}
+		~Basic_sha256_state ()
+		{
+			if (Scrub::on_destruction) {
+				explicit_memzero(state, sizeof(state));
+			}
+		}
+
+		void transform (const unsigned char* block) { compress<Scrub::on_transform, Scrub::working_variables>(state, block); }
+		void write (unsigned char* out, size_t out_len =LENGTH) const
+		{
+			if (out) {
+				write_state(state, out, out_len);
+			}
+		}
+		const uint32_t* get_words () const { return state; }
+		void set_words (const uint32_t* words) { std::memcpy(state, words, sizeof(state)); }
+
+	private:
+		uint32_t	state[8];
+	};
+
+	typedef Basic_sha256_state<Scrub_always> Sha256_state;
+	typedef Block_hash<Sha256_state> Sha256;
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#include "tag.hpp"
+#include <cstring>
+
+using namespace batv;
+
+// In the same order as enum Tag_type
+const Tag_algorithm	batv::tag_algorithms[NUM_TAG_TYPES] = {
+	{ "prvs", 4, PRVS_TAG_VAL_LENGTH, prvs_generate_tag, prvs_validate_tag, prvs_validate_many, prvs_tag_key_num },
+	{ "prvs-sha256", 11, PRVS_SHA256_TAG_VAL_LENGTH, prvs_sha256_generate_tag, prvs_sha256_validate_tag, NULL, prvs_tag_key_num }
+};
+
+const Tag_algorithm*	batv::find_tag_algorithm (const char* tag_type, size_t tag_type_len)
+{
+	// The length alone picks the only candidate, which then just has to match
+	const Tag_algorithm*	candidate;
+	switch (tag_type_len) {
+	case 4:		candidate = &tag_algorithms[TAG_PRVS]; break;
+	case 11:	candidate = &tag_algorithms[TAG_PRVS_SHA256]; break;
+	default:	return NULL;
+	}
+	return std::memcmp(candidate->tag_type, tag_type, tag_type_len) == 0 ? candidate : NULL;
+}
+
+bool	batv::tag_type_usable_with_delimiter (const Tag_algorithm& algorithm, char sub_address_delimiter)
+{
+	return !sub_address_delimiter || !std::memchr(algorithm.tag_type, sub_address_delimiter, algorithm.tag_type_len);
+}
+
+Batv_address	batv::tag_generate (const Tag_algorithm& algorithm, const Email_address& orig_mailfrom, unsigned int lifetime, const Key& key)
+{
+	char		val[MAX_TAG_VAL_LENGTH];
+	algorithm.generate_tag(val, orig_mailfrom.local_part.data(), orig_mailfrom.local_part.size(),
+			       orig_mailfrom.domain.data(), orig_mailfrom.domain.size(),
+			       lifetime, key);
+
+	Batv_address	address;
+	address.tag_type.assign(algorithm.tag_type, algorithm.tag_type_len);
+	address.tag_val.assign(val, algorithm.tag_val_len);
+	address.orig_mailfrom = orig_mailfrom;
+	return address;
+}
+
+bool		batv::tag_validate (const Tag_algorithm& algorithm, const Batv_address_view& address, unsigned int lifetime, const Key& key)
+{
+	return algorithm.validate_tag(address.tag_val.data, address.tag_val.size,
+				      address.orig_mailfrom.local_part.data, address.orig_mailfrom.local_part.size,
+				      address.orig_mailfrom.domain.data, address.orig_mailfrom.domain.size,
+				      lifetime, key);
+}
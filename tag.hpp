@@ -0,0 +1,94 @@
+/*
+ * Copyright 2026 Andrew Ayer
+ *
+ * This file is part of batv-tools.
+ *
+ * batv-tools is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * batv-tools is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with batv-tools.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * Additional permission under GNU GPL version 3 section 7:
+ *
+ * If you modify the Program, or any covered work, by linking or
+ * combining it with the OpenSSL project's OpenSSL library (or a
+ * modified version of that library), containing parts covered by the
+ * terms of the OpenSSL or SSLeay licenses, the licensors of the Program
+ * grant you additional permission to convey the resulting work.
+ * Corresponding Source for a non-source form of such a combination
+ * shall include the source code for the parts of OpenSSL used as well
+ * as that of the covered work.
+ */
+
+#ifndef BATV_TAG_HPP
+#define BATV_TAG_HPP
+
+#include "address.hpp"
+#include "key.hpp"
+#include "prvs.hpp"
+#include <string>
+#include <vector>
+#include <stddef.h>
+
+namespace batv {
+	// A tag algorithm generates and validates the tag-val for one tag-type.
+	// The algorithms are listed in tag_algorithms, indexed by Tag_type, so once
+	// an address's tag-type has been looked up the rest is a table dispatch.
+	struct Tag_algorithm {
+		const char*		tag_type;
+		size_t			tag_type_len;
+		size_t			tag_val_len;	// at most MAX_TAG_VAL_LENGTH
+
+		void			(*generate_tag) (char* tag_val_out,
+							 const char* local_part, size_t local_part_len,
+							 const char* domain, size_t domain_len,
+							 unsigned int lifetime, const Key& key);
+		bool			(*validate_tag) (const char* tag_val, size_t tag_val_len,
+							 const char* local_part, size_t local_part_len,
+							 const char* domain, size_t domain_len,
+							 unsigned int lifetime, const Key& key);
+
+		// Batch validation, like prvs_validate_many, or NULL if there isn't one
+		std::vector<bool>	(*validate_many) (const Batv_address_view* addresses, const Key* const* keys, size_t count, unsigned int lifetime);
+
+		// The number of the key that signed a tag-val (so it can be validated
+		// with that key; see Key::get_num), or -1 if there isn't one
+		int			(*key_num) (const char* tag_val, size_t tag_val_len);
+	};
+
+	enum Tag_type {
+		TAG_PRVS,		// prvs, as in the BATV draft (HMAC-SHA-1)
+		TAG_PRVS_SHA256,	// prvs-sha256: prvs with HMAC-SHA-256
+		NUM_TAG_TYPES
+	};
+
+	enum {
+		MAX_TAG_VAL_LENGTH = PRVS_SHA256_TAG_VAL_LENGTH
+	};
+
+	extern const Tag_algorithm	tag_algorithms[NUM_TAG_TYPES];
+
+	// Returns NULL if the tag-type isn't one we know
+	const Tag_algorithm*	find_tag_algorithm (const char* tag_type, size_t tag_type_len);
+	inline const Tag_algorithm* find_tag_algorithm (const std::string& tag_type) { return find_tag_algorithm(tag_type.data(), tag_type.size()); }
+	inline const Tag_algorithm* find_tag_algorithm (String_view tag_type) { return find_tag_algorithm(tag_type.data, tag_type.size); }
+
+	// Sub-address form is split at the last delimiter, so a tag type containing the
+	// delimiter (e.g. prvs-sha256 with '-') would produce addresses that can't be parsed back.
+	// A delimiter of 0 means standard meta-syntax, which is always usable.
+	bool			tag_type_usable_with_delimiter (const Tag_algorithm&, char sub_address_delimiter);
+
+	// Like prvs_generate and prvs_validate, for any tag algorithm
+	Batv_address		tag_generate (const Tag_algorithm&, const Email_address& orig_mailfrom, unsigned int lifetime, const Key& key);
+	bool			tag_validate (const Tag_algorithm&, const Batv_address_view&, unsigned int lifetime, const Key& key);
+}
+
+#endif
@@ -15,14 +15,26 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "util.hpp"
+#include <cstring>
+#include <vector>
+#include <pthread.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 void explicit_memzero (void* s, size_t n)
 {
+#if defined(__GNUC__)
+	// The empty asm claims to read the memory, so the memset can't be elided
+	std::memset(s, 0, n);
+	__asm__ __volatile__ ("" : : "r" (s) : "memory");
+#else
 	volatile unsigned char* p = reinterpret_cast<unsigned char*>(s);
 
 	while (n--) {
 		*p++ = 0;
 	}
+#endif
 }
 
 void store_be64 (unsigned char* p, uint64_t i)
@@ -36,3 +48,122 @@ void store_be64 (unsigned char* p, uint64_t i)
 	p[1] = i; i >>= 8;
 	p[0] = i;
 }
+
+void store_be32 (unsigned char* p, uint32_t i)
+{
+	p[3] = i; i >>= 8;
+	p[2] = i; i >>= 8;
+	p[1] = i; i >>= 8;
+	p[0] = i;
+}
+
+uint64_t load_be64 (const unsigned char* p)
+{
+	return (static_cast<uint64_t>(load_be32(p)) << 32) | load_be32(p + 4);
+}
+
+uint32_t load_be32 (const unsigned char* p)
+{
+	return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+
+namespace {
+	inline int	hex_digit_value (char c)
+	{
+		if (c >= '0' && c <= '9') {
+			return c - '0';
+		}
+		c = ascii_tolower(c);
+		if (c >= 'a' && c <= 'f') {
+			return c - 'a' + 10;
+		}
+		return -1;
+	}
+
+#if defined(__SSE2__)
+	// Decode 16 hex digits into 8 bytes
+	inline bool	decode_hex16 (const char* hex, unsigned char* out)
+	{
+		const __m128i	chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hex));
+		const __m128i	lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));
+		// Signed compares are fine: bytes >= 0x80 are negative, so they're in neither range
+		const __m128i	is_digit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0' - 1)),
+		                                         _mm_cmplt_epi8(chars, _mm_set1_epi8('9' + 1)));
+		const __m128i	is_letter = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+		                                          _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+		if (_mm_movemask_epi8(_mm_or_si128(is_digit, is_letter)) != 0xFFFF) {
+			return false;
+		}
+		const __m128i	nibbles = _mm_or_si128(_mm_and_si128(is_digit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+		                                       _mm_andnot_si128(is_digit, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+		// Each 16-bit lane holds a high nibble in its low byte and a low nibble in its high byte
+		const __m128i	bytes = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(nibbles, 4), _mm_set1_epi16(0x00F0)),
+		                                     _mm_srli_epi16(nibbles, 8));
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out), _mm_packus_epi16(bytes, bytes));
+		return true;
+	}
+#endif
+
+	struct Parallel_job {
+		void		(*func)(void*, size_t);
+		void*		arg;
+		size_t		count;
+		size_t		next;		// next index to hand out; updated atomically
+	};
+
+	void*		parallel_worker (void* arg)
+	{
+		Parallel_job*	job = static_cast<Parallel_job*>(arg);
+		size_t		i;
+		while ((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->count) {
+			job->func(job->arg, i);
+		}
+		return NULL;
+	}
+}
+
+bool decode_hex (const char* hex, size_t hex_len, unsigned char* out)
+{
+	if (hex_len % 2 != 0) {
+		return false;
+	}
+#if defined(__SSE2__)
+	while (hex_len >= 16) {
+		if (!decode_hex16(hex, out)) {
+			return false;
+		}
+		hex += 16;
+		hex_len -= 16;
+		out += 8;
+	}
+#endif
+	for (; hex_len; hex += 2, hex_len -= 2) {
+		const int	high = hex_digit_value(hex[0]);
+		const int	low = hex_digit_value(hex[1]);
+		if (high == -1 || low == -1) {
+			return false;
+		}
+		*out++ = (high << 4) | low;
+	}
+	return true;
+}
+
+void run_in_parallel (size_t count, unsigned int max_threads, void (*func)(void* arg, size_t i), void* arg)
+{
+	Parallel_job			job = { func, arg, count, 0 };
+	std::vector<pthread_t>		threads;
+
+	// The calling thread is one of the workers; if a thread can't be
+	// created, the threads we do have pick up its share.
+	for (unsigned int i = 1; i < max_threads && i < count; ++i) {
+		pthread_t	thread;
+		if (pthread_create(&thread, NULL, parallel_worker, &job) != 0) {
+			break;
+		}
+		threads.push_back(thread);
+	}
+	parallel_worker(&job);
+	for (size_t i = 0; i < threads.size(); ++i) {
+		pthread_join(threads[i], NULL);
+	}
+}
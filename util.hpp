@@ -20,11 +20,44 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <cstring>
 #include <string>
 
 void	explicit_memzero (void* s, size_t n); // zero memory that won't be optimized away
 void	store_be64 (unsigned char* p, uint64_t i);
+void	store_be32 (unsigned char* p, uint32_t i);
+uint64_t load_be64 (const unsigned char* p);
+uint32_t load_be32 (const unsigned char* p);
 
+// Decode hex_len hex digits (either case) into hex_len/2 bytes at out.  Returns false
+// if hex_len is odd or there's a non-hex character, in which case out is garbage.
+bool	decode_hex (const char* hex, size_t hex_len, unsigned char* out);
+
+// Call func(arg, i) for every i in [0, count), on up to max_threads threads
+// (including the calling thread).  func must not throw.
+void	run_in_parallel (size_t count, unsigned int max_threads, void (*func)(void* arg, size_t i), void* arg);
+
+inline char ascii_tolower (char c) { return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c; } // locale-independent
 inline void chomp (std::string& str) { str.erase(str.find_last_not_of(" \t\r\n") + 1); } // NB: std::string::npos+1==0
 
+// A pointer and length into a string owned by someone else (like C++17's std::string_view)
+struct String_view {
+	const char*	data;
+	size_t		size;
+
+	String_view () : data(""), size(0) { }
+	String_view (const char* arg_data, size_t arg_size) : data(arg_data), size(arg_size) { }
+	String_view (const char* begin, const char* end) : data(begin), size(end - begin) { }
+	String_view (const std::string& str) : data(str.data()), size(str.size()) { }
+	explicit String_view (const char* str) : data(str), size(std::strlen(str)) { }
+
+	bool		empty () const { return size == 0; }
+	const char*	begin () const { return data; }
+	const char*	end () const { return data + size; }
+	std::string	str () const { return std::string(data, size); }
+};
+
+inline bool operator== (String_view a, String_view b) { return a.size == b.size && std::memcmp(a.data, b.data, a.size) == 0; }
+inline bool operator!= (String_view a, String_view b) { return !(a == b); }
+
 #endif
@@ -29,40 +29,89 @@
  */
 
 #include "verify.hpp"
-#include "prvs.hpp"
+#include "tag.hpp"
 #include "address.hpp"
 #include "key.hpp"
 #include "config.hpp"
+#include "common.hpp"
+#include <iostream>
 
 using namespace batv;
 
+namespace {
+	// Everything verify() does short of validating the signature.  Returns
+	// true if *batv_rcpt still needs to be validated with **rcpt_key, using
+	// **algorithm; otherwise, returns false with the outcome in *result.
+	// lazy_key is where a lazy or derived key goes.
+	bool		prepare_verify (const Email_address_view& env_rcpt, Email_address_view* true_rcpt, const Common_config& config, Batv_address_view* batv_rcpt, const Key** rcpt_key, const Tag_algorithm** algorithm, Key* lazy_key, Verify_result* result)
+	{
+		bool		has_batv_rcpt;
+		int		key_num = Key_map::CURRENT_KEY;
+
+		if (batv_rcpt->parse_any(env_rcpt, config.sub_address_delimiter) != Batv_address_view::FORMAT_NONE && (*algorithm = find_tag_algorithm(batv_rcpt->tag_type)) != NULL) {
+			has_batv_rcpt = true;
+			*true_rcpt = batv_rcpt->orig_mailfrom;
+			// Look up the key that signed the tag, which may not be the current one
+			const int	tag_key_num = (*algorithm)->key_num(batv_rcpt->tag_val.data, batv_rcpt->tag_val.size);
+			if (tag_key_num != -1) {
+				key_num = tag_key_num;
+			}
+		} else {
+			has_batv_rcpt = false;
+			*true_rcpt = env_rcpt;
+		}
+
+		try {
+			*rcpt_key = config.get_key(*true_rcpt, lazy_key, key_num);
+		} catch (const Initialization_error& e) {
+			// A lazy key couldn't be loaded
+			std::clog << e.message << std::endl;
+			*result = VERIFY_ERROR;
+			return false;
+		}
+
+		if (!*rcpt_key) {
+			// The recipient of this message is not a BATV user b/c he doesn't have a key
+			*result = VERIFY_NONE;
+			return false;
+		}
+
+		if (!has_batv_rcpt) {
+			// This message was not signed with BATV...
+			*result = VERIFY_MISSING;
+			return false;
+		}
+
+		return true;
+	}
+}
+
 Verify_result batv::verify (const Email_address& env_rcpt, std::string* true_rcpt, const Common_config& config)
 {
-	bool		has_batv_rcpt;
-	Batv_address	batv_rcpt;
-	const Key*	rcpt_key;
-
-	if (batv_rcpt.parse(env_rcpt, config.sub_address_delimiter) && batv_rcpt.tag_type == "prvs") {
-		has_batv_rcpt = true;
-		*true_rcpt = batv_rcpt.orig_mailfrom.make_string();
-	} else {
-		has_batv_rcpt = false;
-		*true_rcpt = env_rcpt.make_string();
-	}
+	Email_address_view	true_rcpt_view;
+	Verify_result		result = verify(Email_address_view(env_rcpt), &true_rcpt_view, config);
+	*true_rcpt = true_rcpt_view.make_string();
+	return result;
+}
 
-	rcpt_key = config.get_key(*true_rcpt);
+Verify_result batv::verify (const Email_address_view& env_rcpt, Email_address_view* true_rcpt, const Common_config& config)
+{
+	std::vector<Key>	lazy_key(config.keys.copies_keys() ? 1 : 0);	// (not constructed unless needed)
+	return verify(env_rcpt, true_rcpt, config, lazy_key.empty() ? NULL : &lazy_key[0]);
+}
 
-	if (!rcpt_key) {
-		// The recipient of this message is not a BATV user b/c he doesn't have a key
-		return VERIFY_NONE;
-	}
+Verify_result batv::verify (const Email_address_view& env_rcpt, Email_address_view* true_rcpt, const Common_config& config, Key* lazy_key)
+{
+	Batv_address_view	batv_rcpt;
+	const Key*		rcpt_key;
+	const Tag_algorithm*	algorithm;
+	Verify_result		result;
 
-	if (!has_batv_rcpt) {
-		// This message was not signed with BATV...
-		return VERIFY_MISSING;
+	if (!prepare_verify(env_rcpt, true_rcpt, config, &batv_rcpt, &rcpt_key, &algorithm, lazy_key, &result)) {
+		return result;
 	}
 
-	if (!prvs_validate(batv_rcpt, config.address_lifetime, *rcpt_key)) {
+	if (!tag_validate(*algorithm, batv_rcpt, config.address_lifetime, *rcpt_key)) {
 		// Message has invalid BATV signature...
 		return VERIFY_BAD_SIGNATURE;
 	}
@@ -70,3 +119,59 @@ Verify_result batv::verify (const Email_address& env_rcpt, std::string* true_rcp
 	return VERIFY_SUCCESS;
 }
 
+std::vector<Verify_result> batv::verify_many (const std::vector<Email_address>& env_rcpts, std::vector<std::string>* true_rcpts, const Common_config& config)
+{
+	// Recipients which need their signature validated, grouped by tag algorithm
+	struct Batch {
+		std::vector<Batv_address_view>	batv_rcpts;	// the recipients...
+		std::vector<const Key*>		rcpt_keys;	// ...their keys...
+		std::vector<size_t>		rcpt_indices;	// ...and their indices in env_rcpts
+	};
+
+	std::vector<Verify_result>	results(env_rcpts.size());
+	Batch				batches[NUM_TAG_TYPES];
+	std::vector<Key>		lazy_keys(config.keys.copies_keys() ? env_rcpts.size() : 0);
+
+	true_rcpts->resize(env_rcpts.size());
+
+	for (size_t i = 0; i < env_rcpts.size(); ++i) {
+		Email_address_view	true_rcpt;
+		Batv_address_view	batv_rcpt;
+		const Key*		rcpt_key;
+		const Tag_algorithm*	algorithm;
+
+		const bool		needs_validation = prepare_verify(env_rcpts[i], &true_rcpt, config, &batv_rcpt, &rcpt_key, &algorithm, lazy_keys.empty() ? NULL : &lazy_keys[i], &results[i]);
+		(*true_rcpts)[i] = true_rcpt.make_string();
+		if (needs_validation) {
+			Batch&		batch(batches[algorithm - tag_algorithms]);
+			batch.batv_rcpts.push_back(batv_rcpt);
+			batch.rcpt_keys.push_back(rcpt_key);
+			batch.rcpt_indices.push_back(i);
+		}
+	}
+
+	for (size_t t = 0; t < NUM_TAG_TYPES; ++t) {
+		const Tag_algorithm&	algorithm(tag_algorithms[t]);
+		const Batch&		batch(batches[t]);
+
+		if (batch.batv_rcpts.empty()) {
+			continue;
+		}
+
+		std::vector<bool>	valid;
+		if (algorithm.validate_many) {
+			valid = algorithm.validate_many(&batch.batv_rcpts[0], &batch.rcpt_keys[0], batch.batv_rcpts.size(), config.address_lifetime);
+		} else {
+			for (size_t j = 0; j < batch.batv_rcpts.size(); ++j) {
+				valid.push_back(tag_validate(algorithm, batch.batv_rcpts[j], config.address_lifetime, *batch.rcpt_keys[j]));
+			}
+		}
+
+		for (size_t j = 0; j < valid.size(); ++j) {
+			// (a message with an invalid signature gets VERIFY_BAD_SIGNATURE)
+			results[batch.rcpt_indices[j]] = valid[j] ? VERIFY_SUCCESS : VERIFY_BAD_SIGNATURE;
+		}
+	}
+
+	return results;
+}
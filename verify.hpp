@@ -32,10 +32,13 @@
 #define BATV_VERIFY_HPP
 
 #include <string>
+#include <vector>
 
 namespace batv {
 	struct Common_config;
 	struct Email_address;
+	struct Email_address_view;
+	class Key;
 
 	enum Verify_result {
 		VERIFY_NONE,		// Message does not need to be validated
@@ -47,6 +50,17 @@ namespace batv {
 	};
 
 	Verify_result verify (const Email_address& env_rcpt, std::string* true_rcpt, const Common_config&);
+
+	// Like above, but doesn't copy the address: *true_rcpt points into env_rcpt
+	Verify_result verify (const Email_address_view& env_rcpt, Email_address_view* true_rcpt, const Common_config&);
+
+	// Like above, but a lazy or derived key is put in *lazy_key (which must be
+	// non-NULL if the config's key map copies keys), so a caller that verifies
+	// repeatedly can reuse one Key's storage
+	Verify_result verify (const Email_address_view& env_rcpt, Email_address_view* true_rcpt, const Common_config&, Key* lazy_key);
+
+	// Like calling verify() on each recipient, but the signatures are validated in one batch
+	std::vector<Verify_result> verify_many (const std::vector<Email_address>& env_rcpts, std::vector<std::string>* true_rcpts, const Common_config&);
 }
 
 #endif